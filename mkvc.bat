@@ -1,3 +1,3 @@
 IF NOT EXIST bin mkdir bin
-cl src\Image.cpp src\ImagePacker.cpp src\Rect.cpp src\GuillotineBinPack.cpp src\main.cpp /EHsc /MT /O2 /link setargv.obj /subsystem:console /OUT:bin/imgp.exe
+cl src\Image.cpp src\ImagePacker.cpp src\Rect.cpp src\BinPack.cpp src\GuillotineBinPack.cpp src\MaxRectsBinPack.cpp src\SkylineBinPack.cpp src\ShelfBinPack.cpp src\MaskBinPack.cpp src\main.cpp /EHsc /MT /O2 /link setargv.obj /subsystem:console /OUT:bin/imgp.exe
     
@@ -0,0 +1,99 @@
+/** @file BinPack.cpp
+    @author Javier Arevalo
+
+    @brief Common interface of the bin packer algorithms.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#include <algorithm>
+#include <cassert>
+
+#include "BinPack.h"
+
+namespace rbp {
+
+BinPack::BinPack()
+:binWidth(0),
+binHeight(0),
+occupiedWidth(0),
+occupiedHeight(0),
+pendingPlaced(0)
+{
+}
+
+void BinPack::ResetBin(int width, int height)
+{
+    binWidth = width;
+    binHeight = height;
+    occupiedWidth = 0;
+    occupiedHeight = 0;
+
+    // Clear any memory of previously packed rectangles.
+    usedRectangles.clear();
+}
+
+void BinPack::GrowBin(int width, int height)
+{
+    assert(width >= binWidth && height >= binHeight);
+    binWidth = width;
+    binHeight = height;
+}
+
+void BinPack::AddUsedRectangle(const Rect &r)
+{
+    occupiedWidth = std::max(occupiedWidth, r.x + r.width);
+    occupiedHeight = std::max(occupiedHeight, r.y + r.height);
+    usedRectangles.push_back(r);
+}
+
+void BinPack::BeginPending(size_t count)
+{
+    pending.resize(count);
+    for(size_t i = 0; i < count; ++i)
+        pending[i] = (int)i;
+    pendingPlaced = 0;
+}
+
+void BinPack::MarkPlaced(size_t position)
+{
+    pending[position] = -1;
+    if (++pendingPlaced * 2 < pending.size())
+        return;
+    pending.erase(std::remove(pending.begin(), pending.end(), -1), pending.end());
+    pendingPlaced = 0;
+}
+
+void BinPack::MarkPlaced(const std::vector<size_t> &positions)
+{
+    for(size_t i = 0; i < positions.size(); ++i)
+        pending[positions[i]] = -1;
+    pendingPlaced += positions.size();
+    if (pendingPlaced * 2 < pending.size())
+        return;
+    pending.erase(std::remove(pending.begin(), pending.end(), -1), pending.end());
+    pendingPlaced = 0;
+}
+
+void BinPack::EndPending(std::vector<RectSize> &rects)
+{
+    // The pending indices are increasing, so the rects can be moved down in place.
+    size_t count = 0;
+    for(size_t i = 0; i < pending.size(); ++i)
+        if (pending[i] >= 0)
+            rects[count++] = rects[pending[i]];
+    rects.resize(count);
+}
+
+/// Computes the ratio of used surface area to the total bin area.
+float BinPack::Occupancy() const
+{
+    ///\todo The occupancy rate could be cached/tracked incrementally instead
+    ///      of looping through the list of packed rectangles here.
+    unsigned long usedSurfaceArea = 0;
+    for(size_t i = 0; i < usedRectangles.size(); ++i)
+        usedSurfaceArea += usedRectangles[i].width * usedRectangles[i].height;
+
+    return (float)usedSurfaceArea / (binWidth * binHeight);
+}
+
+}
@@ -0,0 +1,92 @@
+/** @file BinPack.h
+    @author Javier Arevalo
+
+    @brief Common interface of the bin packer algorithms.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#pragma once
+
+#include <vector>
+
+#include "Rect.h"
+
+namespace rbp {
+
+/** BinPack is the interface shared by all the bin packer algorithms. Each algorithm keeps its own heuristic
+    settings, so a packer can be configured once and then driven through this interface. */
+class BinPack
+{
+public:
+    BinPack();
+    virtual ~BinPack() {}
+
+    /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
+    /// you need to restart with a new bin.
+    virtual void Init(int width, int height) = 0;
+
+    /// Inserts a list of rectangles into the bin using the heuristics configured in the packer.
+    /// @param rects The list of rectangles to add. Placed rectangles are removed from it, so when not all
+    ///        of them fit, it holds the ones left over and packing can resume after Grow.
+    /// @param flip If true, Rectangles may be flipped for more optimal packing.
+    /// @return true if all rectangles fit, false if a rectangle couldn't be placed
+    virtual bool Insert(std::vector<RectSize> &rects, bool flip) = 0;
+
+    /// Inserts a single rectangle into the bin, so rectangles can be placed in a chosen order.
+    /// @return The placed rectangle, with height 0 if it did not fit.
+    virtual Rect Insert(const RectSize &rect, bool flip) = 0;
+
+    /// Enlarges the bin to width x height units, keeping the rectangles packed so far where they are.
+    /// The new space to the right and bottom becomes free.
+    virtual void Grow(int width, int height) = 0;
+
+    /// Computes the ratio of used/total surface area. 0.00 means no space is yet used, 1.00 means the whole bin is used.
+    float Occupancy() const;
+
+    /// Returns the list of packed rectangles.
+    std::vector<Rect> &GetUsedRectangles() { return usedRectangles; }
+
+    int GetWidth() const { return binWidth; }
+    int GetHeight() const { return binHeight; }
+    int GetOccupiedWidth() const { return occupiedWidth; }
+    int GetOccupiedHeight() const { return occupiedHeight; }
+
+protected:
+    int binWidth;
+    int binHeight;
+
+    int occupiedWidth;
+    int occupiedHeight;
+
+    /// Stores a list of all the rectangles that we have packed so far.
+    std::vector<Rect> usedRectangles;
+
+    /// Resets the bin size and forgets all the packed rectangles.
+    void ResetBin(int width, int height);
+
+    /// Changes the bin size, keeping the packed rectangles.
+    void GrowBin(int width, int height);
+
+    /// Adds a placed rectangle to the used list and grows the occupied area.
+    void AddUsedRectangle(const Rect &r);
+
+    /// Indices of the rectangles a batch Insert has still to place, in their order. Placed ones are set to -1
+    /// and only squeezed out once they are half of the list, instead of erasing on every placement. The
+    /// buffer keeps its capacity, so repeated packing does not allocate.
+    std::vector<int> pending;
+    size_t pendingPlaced;
+
+    /// Starts a batch Insert of count rectangles.
+    void BeginPending(size_t count);
+
+    /// Marks the rectangle at the given position of the pending list as placed.
+    void MarkPlaced(size_t position);
+
+    /// Marks the rectangles at the given positions of the pending list as placed.
+    void MarkPlaced(const std::vector<size_t> &positions);
+
+    /// Leaves in rects only the ones that were not placed, keeping their order.
+    void EndPending(std::vector<RectSize> &rects);
+};
+
+}
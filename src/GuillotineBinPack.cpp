@@ -23,25 +23,31 @@ namespace rbp {
 using namespace std;
 
 GuillotineBinPack::GuillotineBinPack()
-:binWidth(0),
-binHeight(0)
+:defaultRectChoice(RectBestShortSideFit),
+defaultSplitMethod(SplitShorterLeftoverAxis),
+defaultMerge(true),
+specializedLoops(true),
+groupPlacement(true),
+onlineValid(false),
+defragCursor(0)
 {
 }
 
 GuillotineBinPack::GuillotineBinPack(int width, int height)
+:defaultRectChoice(RectBestShortSideFit),
+defaultSplitMethod(SplitShorterLeftoverAxis),
+defaultMerge(true),
+specializedLoops(true),
+groupPlacement(true),
+onlineValid(false),
+defragCursor(0)
 {
     Init(width, height);
 }
 
 void GuillotineBinPack::Init(int width, int height)
 {
-    binWidth = width;
-    binHeight = height;
-    occupiedWidth = 0;
-    occupiedHeight = 0;
-
-    // Clear any memory of previously packed rectangles.
-    usedRectangles.clear();
+    ResetBin(width, height);
 
     // We start with a single big free rectangle that spans the whole bin.
     Rect n;
@@ -52,188 +58,134 @@ void GuillotineBinPack::Init(int width, int height)
 
     freeRectangles.clear();
     freeRectangles.push_back(n);
+    onlineValid = false;
+    removedIds.clear();
+    defragCursor = 0;
 }
 
-bool GuillotineBinPack::Insert(std::vector<RectSize> rects, bool merge, bool flip, 
-    FreeRectChoiceHeuristic rectChoice, GuillotineSplitHeuristic splitMethod)
+void GuillotineBinPack::Init(int width, int height, const std::vector<Rect> &occupied)
 {
-    // Remember variables about the best packing choice we have made so far during the iteration process.
-    int bestFreeRect = 0;
-    int bestRect = 0;
-    bool bestFlipped = false;
-
-    // Pack rectangles one at a time until we have cleared the rects array of all rectangles.
-    // rects will get destroyed in the process.
-    while(rects.size() > 0)
+    Init(width, height);
+    for(size_t i = 0; i < occupied.size(); ++i)
     {
-        // Stores the penalty score of the best rectangle placement - bigger=worse, smaller=better.
-        int bestScore = std::numeric_limits<int>::max();
-
-        for(size_t i = 0; i < freeRectangles.size(); ++i)
+        const Rect &r = occupied[i];
+        CarveFreeRects(r);
+        if (r.image)
+            AddUsedRectangle(r);
+        else
         {
-            for(size_t j = 0; j < rects.size(); ++j)
-            {
-                // If this rectangle is a perfect match, we pick it instantly.
-                if (rects[j].width == freeRectangles[i].width && rects[j].height == freeRectangles[i].height)
-                {
-                    bestFreeRect = i;
-                    bestRect = j;
-                    bestFlipped = false;
-                    bestScore = std::numeric_limits<int>::min();
-                    i = freeRectangles.size(); // Force a jump out of the outer loop as well - we got an instant fit.
-                    break;
-                }
-                // If flipping this rectangle is a perfect match, pick that then.
-                else if (flip && rects[j].height == freeRectangles[i].width && rects[j].width == freeRectangles[i].height)
-                {
-                    bestFreeRect = i;
-                    bestRect = j;
-                    bestFlipped = true;
-                    bestScore = std::numeric_limits<int>::min();
-                    i = freeRectangles.size(); // Force a jump out of the outer loop as well - we got an instant fit.
-                    break;
-                }
-                // Try if we can fit the rectangle upright.
-                else if (rects[j].width <= freeRectangles[i].width && rects[j].height <= freeRectangles[i].height)
-                {
-                    int score = ScoreByHeuristic(rects[j].width, rects[j].height, freeRectangles[i], rectChoice);
-                    if (score < bestScore)
-                    {
-                        bestFreeRect = i;
-                        bestRect = j;
-                        bestFlipped = false;
-                        bestScore = score;
-                    }
-                }
-                // If not, then perhaps flipping sideways will make it fit?
-                else if (flip && rects[j].height <= freeRectangles[i].width && rects[j].width <= freeRectangles[i].height)
-                {
-                    int score = ScoreByHeuristic(rects[j].height, rects[j].width, freeRectangles[i], rectChoice);
-                    if (score < bestScore)
-                    {
-                        bestFreeRect = i;
-                        bestRect = j;
-                        bestFlipped = true;
-                        bestScore = score;
-                    }
-                }
-            }
+            occupiedWidth = std::max(occupiedWidth, r.x + r.width);
+            occupiedHeight = std::max(occupiedHeight, r.y + r.height);
         }
-
-        // If we didn't manage to find any rectangle to pack, abort.
-        if (bestScore == std::numeric_limits<int>::max())
-            return false;
-
-        // Otherwise, we're good to go and do the actual packing.
-        Rect newNode;
-        newNode.x = freeRectangles[bestFreeRect].x;
-        newNode.y = freeRectangles[bestFreeRect].y;
-        newNode.width = rects[bestRect].width;
-        newNode.height = rects[bestRect].height;
-        newNode.flipped = bestFlipped;
-        newNode.image = rects[bestRect].image;
-
-        if (bestFlipped)
-            std::swap(newNode.width, newNode.height);
-
-        occupiedWidth = std::max(occupiedWidth, newNode.x + newNode.width);
-        occupiedHeight = std::max(occupiedHeight, newNode.y + newNode.height);
-
-        // Remove the free space we lost in the bin.
-        SplitFreeRectByHeuristic(freeRectangles[bestFreeRect], newNode, splitMethod);
-        freeRectangles.erase(freeRectangles.begin() + bestFreeRect);
-
-        // Remove the rectangle we just packed from the input list.
-        rects.erase(rects.begin() + bestRect);
-
-        // Perform a Rectangle Merge step if desired.
-        if (merge)
-            MergeFreeList();
-
-        // Remember the new used rectangle.
-        usedRectangles.push_back(newNode);
     }
-    return true;
+    if (defaultMerge)
+        MergeFreeList();
 }
 
-/// @return True if r fits inside freeRect (possibly rotated).
-bool Fits(const RectSize &r, const Rect &freeRect)
+void GuillotineBinPack::SetHeuristics(FreeRectChoiceHeuristic rectChoice, GuillotineSplitHeuristic splitMethod, bool merge)
 {
-    return (r.width <= freeRect.width && r.height <= freeRect.height) ||
-        (r.height <= freeRect.width && r.width <= freeRect.height);
+    defaultRectChoice = rectChoice;
+    defaultSplitMethod = splitMethod;
+    defaultMerge = merge;
 }
 
-/// @return True if r fits perfectly inside freeRect, i.e. the leftover area is 0.
-bool FitsPerfectly(const RectSize &r, const Rect &freeRect)
+bool GuillotineBinPack::Insert(std::vector<RectSize> &rects, bool flip)
 {
-    return (r.width == freeRect.width && r.height == freeRect.height) ||
-        (r.height == freeRect.width && r.width == freeRect.height);
+    return Insert(rects, defaultMerge, flip, defaultRectChoice, defaultSplitMethod);
 }
 
-/// Computes the ratio of used surface area to the total bin area.
-float GuillotineBinPack::Occupancy() const
+Rect GuillotineBinPack::Insert(const RectSize &rect, bool flip)
 {
-    ///\todo The occupancy rate could be cached/tracked incrementally instead
-    ///      of looping through the list of packed rectangles here.
-    unsigned long usedSurfaceArea = 0;
-    for(size_t i = 0; i < usedRectangles.size(); ++i)
-        usedSurfaceArea += usedRectangles[i].width * usedRectangles[i].height;
+    Rect newRect = Insert(rect.width, rect.height, defaultMerge, flip, defaultRectChoice, defaultSplitMethod);
+    if (newRect.height != 0)
+    {
+        // The size based version does not know about images.
+        newRect.image = rect.image;
+        usedRectangles.back().image = rect.image;
+    }
+    return newRect;
+}
 
-    return (float)usedSurfaceArea / (binWidth * binHeight);
+void GuillotineBinPack::Grow(int width, int height)
+{
+    onlineValid = false;
+    Rect n;
+    if (width > binWidth)
+    {
+        // Strip to the right of the old bin.
+        n.x = binWidth;
+        n.y = 0;
+        n.width = width - binWidth;
+        n.height = binHeight;
+        freeRectangles.push_back(n);
+    }
+    if (height > binHeight)
+    {
+        // Strip below the old bin, including the corner.
+        n.x = 0;
+        n.y = binHeight;
+        n.width = width;
+        n.height = height - binHeight;
+        freeRectangles.push_back(n);
+    }
+    GrowBin(width, height);
+    if (defaultMerge)
+        MergeFreeList();
 }
 
-/// Returns the heuristic score value for placing a rectangle of size width*height into freeRect. Does not try to rotate.
-int GuillotineBinPack::ScoreByHeuristic(int width, int height, const Rect &freeRect, FreeRectChoiceHeuristic rectChoice)
+/// Returns the heuristic score value for placing a rectangle of size width*height into a free rectangle of size
+/// freeWidth*freeHeight. Does not try to rotate.
+inline int GuillotineBinPack::ScoreByHeuristic(int width, int height, int freeWidth, int freeHeight, FreeRectChoiceHeuristic rectChoice)
 {
     switch(rectChoice)
     {
-    case RectBestAreaFit: return ScoreBestAreaFit(width, height, freeRect);
-    case RectBestShortSideFit: return ScoreBestShortSideFit(width, height, freeRect);
-    case RectBestLongSideFit: return ScoreBestLongSideFit(width, height, freeRect);
-    case RectWorstAreaFit: return ScoreWorstAreaFit(width, height, freeRect);
-    case RectWorstShortSideFit: return ScoreWorstShortSideFit(width, height, freeRect);
-    case RectWorstLongSideFit: return ScoreWorstLongSideFit(width, height, freeRect);
+    case RectBestAreaFit: return ScoreBestAreaFit(width, height, freeWidth, freeHeight);
+    case RectBestShortSideFit: return ScoreBestShortSideFit(width, height, freeWidth, freeHeight);
+    case RectBestLongSideFit: return ScoreBestLongSideFit(width, height, freeWidth, freeHeight);
+    case RectWorstAreaFit: return ScoreWorstAreaFit(width, height, freeWidth, freeHeight);
+    case RectWorstShortSideFit: return ScoreWorstShortSideFit(width, height, freeWidth, freeHeight);
+    case RectWorstLongSideFit: return ScoreWorstLongSideFit(width, height, freeWidth, freeHeight);
     default: assert(false); return std::numeric_limits<int>::max();
     }
 }
 
-int GuillotineBinPack::ScoreBestAreaFit(int width, int height, const Rect &freeRect)
+inline int GuillotineBinPack::ScoreBestAreaFit(int width, int height, int freeWidth, int freeHeight)
 {
-    return freeRect.width * freeRect.height - width * height;
+    return freeWidth * freeHeight - width * height;
 }
 
-int GuillotineBinPack::ScoreBestShortSideFit(int width, int height, const Rect &freeRect)
+inline int GuillotineBinPack::ScoreBestShortSideFit(int width, int height, int freeWidth, int freeHeight)
 {
-    int leftoverHoriz = abs(freeRect.width - width);
-    int leftoverVert = abs(freeRect.height - height);
+    int leftoverHoriz = abs(freeWidth - width);
+    int leftoverVert = abs(freeHeight - height);
     int leftover = min(leftoverHoriz, leftoverVert);
     return leftover;
 }
 
-int GuillotineBinPack::ScoreBestLongSideFit(int width, int height, const Rect &freeRect)
+inline int GuillotineBinPack::ScoreBestLongSideFit(int width, int height, int freeWidth, int freeHeight)
 {
-    int leftoverHoriz = abs(freeRect.width - width);
-    int leftoverVert = abs(freeRect.height - height);
+    int leftoverHoriz = abs(freeWidth - width);
+    int leftoverVert = abs(freeHeight - height);
     int leftover = max(leftoverHoriz, leftoverVert);
     return leftover;
 }
 
-int GuillotineBinPack::ScoreWorstAreaFit(int width, int height, const Rect &freeRect)
+inline int GuillotineBinPack::ScoreWorstAreaFit(int width, int height, int freeWidth, int freeHeight)
 {
-    return -ScoreBestAreaFit(width, height, freeRect);
+    return -ScoreBestAreaFit(width, height, freeWidth, freeHeight);
 }
 
-int GuillotineBinPack::ScoreWorstShortSideFit(int width, int height, const Rect &freeRect)
+inline int GuillotineBinPack::ScoreWorstShortSideFit(int width, int height, int freeWidth, int freeHeight)
 {
-    return -ScoreBestShortSideFit(width, height, freeRect);
+    return -ScoreBestShortSideFit(width, height, freeWidth, freeHeight);
 }
 
-int GuillotineBinPack::ScoreWorstLongSideFit(int width, int height, const Rect &freeRect)
+inline int GuillotineBinPack::ScoreWorstLongSideFit(int width, int height, int freeWidth, int freeHeight)
 {
-    return -ScoreBestLongSideFit(width, height, freeRect);
+    return -ScoreBestLongSideFit(width, height, freeWidth, freeHeight);
 }
 
-void GuillotineBinPack::SplitFreeRectByHeuristic(const Rect &freeRect, const Rect &placedRect, GuillotineSplitHeuristic method)
+inline bool GuillotineBinPack::SplitHorizontalByHeuristic(const Rect &freeRect, const Rect &placedRect, GuillotineSplitHeuristic method)
 {
     // Compute the lengths of the leftover area.
     const int w = freeRect.width - placedRect.width;
@@ -245,42 +197,752 @@ void GuillotineBinPack::SplitFreeRectByHeuristic(const Rect &freeRect, const Rec
 
     // Use the given heuristic to decide which choice to make.
 
-    bool splitHorizontal;
     switch(method)
     {
     case SplitShorterLeftoverAxis:
         // Split along the shorter leftover axis.
-        splitHorizontal = (w <= h);
-        break;
+        return w <= h;
     case SplitLongerLeftoverAxis:
         // Split along the longer leftover axis.
-        splitHorizontal = (w > h);
-        break;
+        return w > h;
     case SplitMinimizeArea:
         // Maximize the larger area == minimize the smaller area.
         // Tries to make the single bigger rectangle.
-        splitHorizontal = (placedRect.width * h > w * placedRect.height);
-        break;
+        return placedRect.width * h > w * placedRect.height;
     case SplitMaximizeArea:
         // Maximize the smaller area == minimize the larger area.
         // Tries to make the rectangles more even-sized.
-        splitHorizontal = (placedRect.width * h <= w * placedRect.height);
-        break;
+        return placedRect.width * h <= w * placedRect.height;
     case SplitShorterAxis:
         // Split along the shorter total axis.
-        splitHorizontal = (freeRect.width <= freeRect.height);
-        break;
+        return freeRect.width <= freeRect.height;
     case SplitLongerAxis:
         // Split along the longer total axis.
-        splitHorizontal = (freeRect.width > freeRect.height);
-        break;
+        return freeRect.width > freeRect.height;
     default:
-        splitHorizontal = true;
         assert(false);
+        return true;
+    }
+}
+
+/// Heuristics chosen at run time, switching on them for every free rectangle scored.
+struct GuillotineBinPack::RuntimeHeuristics
+{
+    FreeRectChoiceHeuristic rectChoice;
+    GuillotineSplitHeuristic splitMethod;
+
+    int Score(int width, int height, int freeWidth, int freeHeight) const
+    {
+        return ScoreByHeuristic(width, height, freeWidth, freeHeight, rectChoice);
+    }
+
+    bool SplitHorizontal(const Rect &freeRect, const Rect &placedRect) const
+    {
+        return SplitHorizontalByHeuristic(freeRect, placedRect, splitMethod);
+    }
+};
+
+/// Heuristics fixed at compile time. The switches fold away, so the scoring inlines into the Insert loop.
+template<GuillotineBinPack::FreeRectChoiceHeuristic rectChoice, GuillotineBinPack::GuillotineSplitHeuristic splitMethod>
+struct GuillotineBinPack::FixedHeuristics
+{
+    int Score(int width, int height, int freeWidth, int freeHeight) const
+    {
+        return ScoreByHeuristic(width, height, freeWidth, freeHeight, rectChoice);
+    }
+
+    bool SplitHorizontal(const Rect &freeRect, const Rect &placedRect) const
+    {
+        return SplitHorizontalByHeuristic(freeRect, placedRect, splitMethod);
+    }
+};
+
+template<class Heuristics>
+int GuillotineBinPack::ScoreFreeRects(int width, int height, bool flip, size_t begin, size_t end, const Heuristics &heuristics)
+{
+    if (freeScores.size() < end)
+        freeScores.resize(end);
+    const int *freeWidth = freeRectangles.width.data();
+    const int *freeHeight = freeRectangles.height.data();
+    int *scores = freeScores.data();
+
+    // Without branches, so the compiler can score several free rectangles per instruction. The smallest score
+    // is found in a second loop, which vectorizes too, where a single loop would not.
+    for(size_t i = begin; i < end; ++i)
+    {
+        const int w = freeWidth[i];
+        const int h = freeHeight[i];
+        const bool perfect = ((width == w) & (height == h)) | (flip & (height == w) & (width == h));
+        const bool fitsUpright = (width <= w) & (height <= h);
+        const bool fitsFlipped = flip & (height <= w) & (width <= h);
+        const int uprightScore = heuristics.Score(width, height, w, h);
+        const int flippedScore = heuristics.Score(height, width, w, h);
+        const int score = perfect ? std::numeric_limits<int>::min() :
+            fitsUpright ? uprightScore :
+            fitsFlipped ? flippedScore : std::numeric_limits<int>::max();
+        scores[i] = score;
+    }
+    int minScore = std::numeric_limits<int>::max();
+    for(size_t i = begin; i < end; ++i)
+        minScore = min(minScore, scores[i]);
+    return minScore;
+}
+
+size_t GuillotineBinPack::FindFreeScore(int score, size_t begin) const
+{
+    size_t i = begin;
+    while(freeScores[i] != score)
+        ++i;
+    return i;
+}
+
+bool GuillotineBinPack::FitsFlipped(int width, int height, bool flip, size_t i) const
+{
+    const int w = freeRectangles.width[i];
+    const int h = freeRectangles.height[i];
+    // Same order of preference as ScoreFreeRects: perfect fits first, then upright.
+    if (width == w && height == h)
+        return false;
+    if (flip && height == w && width == h)
+        return true;
+    return !(width <= w && height <= h);
+}
+
+bool GuillotineBinPack::Insert(std::vector<RectSize> &rects, bool merge, bool flip, 
+    FreeRectChoiceHeuristic rectChoice, GuillotineSplitHeuristic splitMethod)
+{
+    onlineValid = false;
+    if (!specializedLoops)
+    {
+        RuntimeHeuristics heuristics = { rectChoice, splitMethod };
+        return InsertLoop(rects, merge, flip, heuristics);
+    }
+
+    // Pick the Insert loop instantiated for this combination of heuristics.
+    switch(rectChoice)
+    {
+    case RectBestAreaFit: return InsertFixedChoice<RectBestAreaFit>(rects, merge, flip, splitMethod);
+    case RectBestShortSideFit: return InsertFixedChoice<RectBestShortSideFit>(rects, merge, flip, splitMethod);
+    case RectBestLongSideFit: return InsertFixedChoice<RectBestLongSideFit>(rects, merge, flip, splitMethod);
+    case RectWorstAreaFit: return InsertFixedChoice<RectWorstAreaFit>(rects, merge, flip, splitMethod);
+    case RectWorstShortSideFit: return InsertFixedChoice<RectWorstShortSideFit>(rects, merge, flip, splitMethod);
+    case RectWorstLongSideFit: return InsertFixedChoice<RectWorstLongSideFit>(rects, merge, flip, splitMethod);
+    default: assert(false); return false;
+    }
+}
+
+template<GuillotineBinPack::FreeRectChoiceHeuristic rectChoice>
+bool GuillotineBinPack::InsertFixedChoice(std::vector<RectSize> &rects, bool merge, bool flip, GuillotineSplitHeuristic splitMethod)
+{
+    switch(splitMethod)
+    {
+    case SplitShorterLeftoverAxis: return InsertLoop(rects, merge, flip, FixedHeuristics<rectChoice, SplitShorterLeftoverAxis>());
+    case SplitLongerLeftoverAxis: return InsertLoop(rects, merge, flip, FixedHeuristics<rectChoice, SplitLongerLeftoverAxis>());
+    case SplitMinimizeArea: return InsertLoop(rects, merge, flip, FixedHeuristics<rectChoice, SplitMinimizeArea>());
+    case SplitMaximizeArea: return InsertLoop(rects, merge, flip, FixedHeuristics<rectChoice, SplitMaximizeArea>());
+    case SplitShorterAxis: return InsertLoop(rects, merge, flip, FixedHeuristics<rectChoice, SplitShorterAxis>());
+    case SplitLongerAxis: return InsertLoop(rects, merge, flip, FixedHeuristics<rectChoice, SplitLongerAxis>());
+    default: assert(false); return false;
+    }
+}
+
+void GuillotineBinPack::BuildSizeGroups(const std::vector<RectSize> &rects)
+{
+    sizeGroupRects.resize(rects.size());
+    for(size_t i = 0; i < rects.size(); ++i)
+        sizeGroupRects[i] = (int)i;
+    std::sort(sizeGroupRects.begin(), sizeGroupRects.end(), [&](int a, int b) {
+        if (rects[a].width != rects[b].width)
+            return rects[a].width < rects[b].width;
+        if (rects[a].height != rects[b].height)
+            return rects[a].height < rects[b].height;
+        return a < b;
+    });
+    sizeGroupOf.resize(rects.size());
+    sizeGroupNext.clear();
+    sizeGroupEnd.clear();
+    for(size_t i = 0; i < sizeGroupRects.size(); ++i)
+    {
+        const RectSize &rect = rects[sizeGroupRects[i]];
+        if (i == 0 || rect.width != rects[sizeGroupRects[i-1]].width || rect.height != rects[sizeGroupRects[i-1]].height)
+        {
+            sizeGroupNext.push_back((int)i);
+            sizeGroupEnd.push_back((int)i);
+        }
+        sizeGroupOf[sizeGroupRects[i]] = (int)sizeGroupNext.size() - 1;
+        ++sizeGroupEnd.back();
+    }
+}
+
+template<class Heuristics>
+bool GuillotineBinPack::InsertLoop(std::vector<RectSize> &rects, bool merge, bool flip, const Heuristics &heuristics)
+{
+    // Pack rectangles one at a time until we have placed all the pending rectangles.
+    // Placed rects are removed at the end, so on failure the ones left remain in the array.
+    BeginPending(rects.size());
+    BuildSizeGroups(rects);
+    while(pending.size() > pendingPlaced)
+    {
+        // Remember variables about the best packing choice we have made so far during the iteration process.
+        // Stores the penalty score of the best rectangle placement - bigger=worse, smaller=better.
+        int bestScore = std::numeric_limits<int>::max();
+        size_t bestFreeRect = 0;
+        size_t bestRect = 0;
+
+        // Score the rectangles against blocks of free rectangles at once, so a perfect fit still ends the search
+        // early. Ties go to the first free rectangle, then to the first rectangle.
+        const size_t freeCount = freeRectangles.size();
+        size_t blockSize = FirstFreeBlockSize;
+        for(size_t begin = 0; begin < freeCount && bestScore != std::numeric_limits<int>::min(); begin += blockSize, blockSize *= 2)
+        {
+            size_t end = min(begin + blockSize, freeCount);
+            for(size_t j = 0; j < pending.size(); ++j)
+            {
+                if (pending[j] < 0)
+                    continue;
+                // A rectangle the same size as one before it scores the same and loses the ties, so only the first
+                // one left of each size is scored.
+                if (sizeGroupRects[sizeGroupNext[sizeGroupOf[pending[j]]]] != pending[j])
+                    continue;
+                const RectSize &rect = rects[pending[j]];
+
+                int score = ScoreFreeRects(rect.width, rect.height, flip, begin, end, heuristics);
+                if (score > bestScore || score == std::numeric_limits<int>::max())
+                    continue;
+                size_t i = FindFreeScore(score, begin);
+                if (score < bestScore || (score == bestScore && i < bestFreeRect))
+                {
+                    bestFreeRect = i;
+                    bestRect = j;
+                    bestScore = score;
+                }
+                // Nothing beats a perfect fit, so only the free rectangles before it are left to try.
+                if (bestScore == std::numeric_limits<int>::min())
+                    end = bestFreeRect;
+            }
+        }
+
+        // If we didn't manage to find any rectangle to pack, abort.
+        if (bestScore == std::numeric_limits<int>::max())
+        {
+            EndPending(rects);
+            return false;
+        }
+
+        // Otherwise, we're good to go and do the actual packing.
+        const RectSize &rect = rects[pending[bestRect]];
+        const Rect freeRect = freeRectangles[bestFreeRect];
+        Rect newNode;
+        newNode.x = freeRect.x;
+        newNode.y = freeRect.y;
+        newNode.width = rect.width;
+        newNode.height = rect.height;
+        newNode.flipped = FitsFlipped(rect.width, rect.height, flip, bestFreeRect);
+        newNode.image = rect.image;
+
+        if (newNode.flipped)
+            std::swap(newNode.width, newNode.height);
+
+        // When the free rectangle fits the rectangle exactly across, the rectangles of the same size left go in a
+        // row or column along it, as many as fit. One at a time, they would mostly end up there anyway.
+        int group = sizeGroupOf[pending[bestRect]];
+        int count = groupPlacement ? sizeGroupEnd[group] - sizeGroupNext[group] : 1;
+        int cols = 1, rows = 1;
+        if (freeRect.height == newNode.height)
+            cols = min(count, freeRect.width / newNode.width);
+        else if (freeRect.width == newNode.width)
+            rows = min(count, freeRect.height / newNode.height);
+        Rect block = newNode;
+        block.width = cols * newNode.width;
+        block.height = rows * newNode.height;
+
+        // Remove the free space we lost in the bin.
+        SplitFreeRectAlongAxis(freeRect, block, heuristics.SplitHorizontal(freeRect, block));
+        freeRectangles.erase(bestFreeRect);
+
+        // The rest of the group is after the first one left in the pending list, in the same order.
+        groupPositions.clear();
+        for(size_t j = bestRect; groupPositions.size() < (size_t)(cols * rows); ++j)
+        {
+            if (pending[j] < 0 || sizeGroupOf[pending[j]] != group)
+                continue;
+            Rect cell = newNode;
+            cell.x = block.x + (int)(groupPositions.size() % cols) * newNode.width;
+            cell.y = block.y + (int)(groupPositions.size() / cols) * newNode.height;
+            cell.image = rects[pending[j]].image;
+            groupPositions.push_back(j);
+
+            // Remember the new used rectangle.
+            AddUsedRectangle(cell);
+        }
+        sizeGroupNext[group] += cols * rows;
+
+        // Remove the rectangles we just packed from the pending list.
+        MarkPlaced(groupPositions);
+
+        // Perform a Rectangle Merge step if desired.
+        if (merge)
+            MergeFreeList();
+    }
+    rects.clear();
+    return true;
+}
+
+Rect GuillotineBinPack::Insert(int width, int height, bool merge, bool flip, FreeRectChoiceHeuristic rectChoice,
+    GuillotineSplitHeuristic splitMethod)
+{
+    onlineValid = false;
+
+    // Find where to put the new rectangle.
+    int freeNodeIndex = 0;
+    Rect newRect = FindPositionForNewNode(width, height, flip, rectChoice, &freeNodeIndex);
+
+    // Abort if we didn't have enough space in the bin.
+    if (newRect.height == 0)
+        return newRect;
+
+    // Remove the space that was just consumed by the new rectangle.
+    SplitFreeRectByHeuristic(freeRectangles[freeNodeIndex], newRect, splitMethod);
+    freeRectangles.erase(freeNodeIndex);
+
+    // Perform a Rectangle Merge step if desired.
+    if (merge)
+        MergeFreeList();
+
+    // Remember the new used rectangle.
+    AddUsedRectangle(newRect);
+
+    return newRect;
+}
+
+Rect GuillotineBinPack::FindPositionForNewNode(int width, int height, bool flip, FreeRectChoiceHeuristic rectChoice, int *nodeIndex)
+{
+    Rect bestNode;
+    bestNode.x = bestNode.y = bestNode.width = bestNode.height = 0;
+    bestNode.image = nullptr;
+    bestNode.flipped = false;
+
+    // Try each free rectangle to find the best one for placement. Only the choice heuristic is used.
+    RuntimeHeuristics heuristics = { rectChoice, SplitShorterLeftoverAxis };
+    int bestScore = ScoreFreeRects(width, height, flip, 0, freeRectangles.size(), heuristics);
+    if (bestScore == std::numeric_limits<int>::max())
+        return bestNode;
+
+    size_t i = FindFreeScore(bestScore, 0);
+    bestNode.x = freeRectangles.x[i];
+    bestNode.y = freeRectangles.y[i];
+    bestNode.flipped = FitsFlipped(width, height, flip, i);
+    bestNode.width = bestNode.flipped ? height : width;
+    bestNode.height = bestNode.flipped ? width : height;
+    *nodeIndex = (int)i;
+    return bestNode;
+}
+
+Rect GuillotineBinPack::TryInsert(int width, int height, bool flip, int *rectId)
+{
+    if (!onlineValid)
+        BuildOnlineState();
+
+    Rect newRect;
+    newRect.x = newRect.y = newRect.width = newRect.height = 0;
+    newRect.image = nullptr;
+    newRect.flipped = false;
+
+    // Take the smallest size class that fits either way, ties go to the better score.
+    int level = 0, score = 0;
+    int freeNodeIndex = FindSizeClassFit(width, height, &level, &score);
+    if (flip)
+    {
+        int flippedLevel = 0, flippedScore = 0;
+        int flippedIndex = FindSizeClassFit(height, width, &flippedLevel, &flippedScore);
+        if (flippedIndex >= 0 && (freeNodeIndex < 0 || flippedLevel < level || (flippedLevel == level && flippedScore < score)))
+        {
+            freeNodeIndex = flippedIndex;
+            newRect.flipped = true;
+        }
+    }
+    if (freeNodeIndex < 0)
+        return newRect;
+
+    newRect.x = freeRectangles.x[freeNodeIndex];
+    newRect.y = freeRectangles.y[freeNodeIndex];
+    newRect.width = newRect.flipped ? height : width;
+    newRect.height = newRect.flipped ? width : height;
+
+    // Reuse the id of a removed rectangle if there is one.
+    int id = (int)usedRectangles.size();
+    if (removedIds.empty())
+    {
+        AddUsedRectangle(newRect);
+        usedNodes.push_back(-1);
+    }
+    else
+    {
+        id = removedIds.back();
+        removedIds.pop_back();
+        usedRectangles[id] = newRect;
+        occupiedWidth = max(occupiedWidth, newRect.x + newRect.width);
+        occupiedHeight = max(occupiedHeight, newRect.y + newRect.height);
+    }
+    PlaceInFreeNode(freeNodeIndex, newRect, id);
+    if (rectId)
+        *rectId = id;
+    return newRect;
+}
+
+void GuillotineBinPack::Remove(int rectId)
+{
+    assert(rectId >= 0 && (size_t)rectId < usedRectangles.size() && usedRectangles[rectId].height > 0);
+    if (!onlineValid)
+        BuildOnlineState();
+
+    FreeSplitNode(usedNodes[rectId]);
+    usedNodes[rectId] = -1;
+    Rect &r = usedRectangles[rectId];
+    r.width = r.height = 0;
+    r.image = nullptr;
+    removedIds.push_back(rectId);
+}
+
+int GuillotineBinPack::Defragment(int maxMoves, std::vector<RectMove> &moves)
+{
+    if (!onlineValid)
+        BuildOnlineState();
+
+    int moved = 0;
+    const size_t tries = min(usedRectangles.size(), (size_t)max(maxMoves, 0) * 4);
+    for(size_t t = 0; t < tries && moved < maxMoves; ++t)
+    {
+        if (defragCursor >= usedRectangles.size())
+            defragCursor = 0;
+        const int id = (int)defragCursor++;
+        const Rect from = usedRectangles[id];
+        if (from.height == 0)
+            continue;
+
+        // Find the block of free space that moving the rectangle out would leave, merged with its free neighbours.
+        int block = usedNodes[id];
+        while(splitNodes[block].parent >= 0)
+        {
+            const SplitNode &parent = splitNodes[splitNodes[block].parent];
+            const int sibling = parent.children[0] == block ? parent.children[1] : parent.children[0];
+            if (splitNodes[sibling].freeRect < 0)
+                break;
+            block = splitNodes[block].parent;
+        }
+        const SplitNode &b = splitNodes[block];
+        const long long blockArea = (long long)b.width * b.height;
+        if (block == usedNodes[id])
+            continue;
+
+        // Move it to the smallest free rectangle outside that block, if that is smaller than the block.
+        int bestFreeRect = -1;
+        long long bestArea = blockArea;
+        for(size_t i = 0; i < freeRectangles.size(); ++i)
+        {
+            const int x = freeRectangles.x[i];
+            const int y = freeRectangles.y[i];
+            const int width = freeRectangles.width[i];
+            const int height = freeRectangles.height[i];
+            const long long area = (long long)width * height;
+            if (area >= bestArea || from.width > width || from.height > height)
+                continue;
+            if (x >= b.x && y >= b.y && x + width <= b.x + b.width && y + height <= b.y + b.height)
+                continue;
+            bestFreeRect = (int)i;
+            bestArea = area;
+        }
+        if (bestFreeRect < 0)
+            continue;
+
+        Rect to = from;
+        to.x = freeRectangles.x[bestFreeRect];
+        to.y = freeRectangles.y[bestFreeRect];
+        const int oldNode = usedNodes[id];
+        PlaceInFreeNode(bestFreeRect, to, id);
+        FreeSplitNode(oldNode);
+        usedRectangles[id] = to;
+
+        RectMove move = { id, from, to };
+        moves.push_back(move);
+        ++moved;
+    }
+    return moved;
+}
+
+float GuillotineBinPack::Fragmentation() const
+{
+    long long freeArea = 0;
+    long long largest = 0;
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const long long area = (long long)freeRectangles.width[i] * freeRectangles.height[i];
+        freeArea += area;
+        largest = max(largest, area);
+    }
+    return freeArea > 0 ? 1.0f - (float)largest / freeArea : 0.0f;
+}
+
+int GuillotineBinPack::SizeClass(int side)
+{
+    int sizeClass = 0;
+    while(sizeClass < SizeClasses - 1 && (side >> (sizeClass + 1)) != 0)
+        ++sizeClass;
+    return sizeClass;
+}
+
+void GuillotineBinPack::BuildOnlineState()
+{
+    for(int w = 0; w < SizeClasses; ++w)
+    {
+        for(int h = 0; h < SizeClasses; ++h)
+            freeClassHead[w][h] = -1;
+        freeClassMask[w] = 0;
+    }
+
+    // Without the splits that made them, each rectangle is the root of its own tree.
+    splitNodes.clear();
+    releasedNodes.clear();
+    freeNodes.resize(freeRectangles.size());
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        freeNodes[i] = NewSplitNode(freeRectangles[i], -1);
+        splitNodes[freeNodes[i]].freeRect = (int)i;
+        LinkSizeClass((int)i);
+    }
+    usedNodes.resize(usedRectangles.size());
+    for(size_t i = 0; i < usedRectangles.size(); ++i)
+    {
+        usedNodes[i] = -1;
+        if (usedRectangles[i].height > 0)
+        {
+            usedNodes[i] = NewSplitNode(usedRectangles[i], -1);
+            splitNodes[usedNodes[i]].rectId = (int)i;
+        }
+    }
+    onlineValid = true;
+}
+
+void GuillotineBinPack::LinkSizeClass(int freeRect)
+{
+    if (freeClassNext.size() <= (size_t)freeRect)
+    {
+        freeClassNext.resize(freeRectangles.size());
+        freeClassPrev.resize(freeRectangles.size());
+    }
+    const int w = SizeClass(freeRectangles.width[freeRect]);
+    const int h = SizeClass(freeRectangles.height[freeRect]);
+    const int head = freeClassHead[w][h];
+    freeClassNext[freeRect] = head;
+    freeClassPrev[freeRect] = -1;
+    if (head >= 0)
+        freeClassPrev[head] = freeRect;
+    freeClassHead[w][h] = freeRect;
+    freeClassMask[w] |= 1u << h;
+}
+
+void GuillotineBinPack::UnlinkSizeClass(int freeRect)
+{
+    const int w = SizeClass(freeRectangles.width[freeRect]);
+    const int h = SizeClass(freeRectangles.height[freeRect]);
+    const int next = freeClassNext[freeRect];
+    const int prev = freeClassPrev[freeRect];
+    if (prev >= 0)
+        freeClassNext[prev] = next;
+    else
+        freeClassHead[w][h] = next;
+    if (next >= 0)
+        freeClassPrev[next] = prev;
+    if (freeClassHead[w][h] < 0)
+        freeClassMask[w] &= ~(1u << h);
+}
+
+int GuillotineBinPack::NewSplitNode(const Rect &r, int parent)
+{
+    int node = (int)splitNodes.size();
+    if (releasedNodes.empty())
+        splitNodes.push_back(SplitNode());
+    else
+    {
+        node = releasedNodes.back();
+        releasedNodes.pop_back();
+    }
+    SplitNode &n = splitNodes[node];
+    n.x = r.x;
+    n.y = r.y;
+    n.width = r.width;
+    n.height = r.height;
+    n.parent = parent;
+    n.children[0] = n.children[1] = -1;
+    n.freeRect = -1;
+    n.rectId = -1;
+    return node;
+}
+
+void GuillotineBinPack::AddFreeNode(int node)
+{
+    const SplitNode &n = splitNodes[node];
+    Rect r;
+    r.x = n.x;
+    r.y = n.y;
+    r.width = n.width;
+    r.height = n.height;
+    freeRectangles.push_back(r);
+    freeNodes.push_back(node);
+    splitNodes[node].freeRect = (int)freeRectangles.size() - 1;
+    LinkSizeClass((int)freeRectangles.size() - 1);
+}
+
+void GuillotineBinPack::RemoveFreeNode(int node)
+{
+    const int freeRect = splitNodes[node].freeRect;
+    splitNodes[node].freeRect = -1;
+    UnlinkSizeClass(freeRect);
+
+    // Move the last free rectangle into its place.
+    const int last = (int)freeRectangles.size() - 1;
+    if (freeRect != last)
+    {
+        UnlinkSizeClass(last);
+        freeRectangles.x[freeRect] = freeRectangles.x[last];
+        freeRectangles.y[freeRect] = freeRectangles.y[last];
+        freeRectangles.width[freeRect] = freeRectangles.width[last];
+        freeRectangles.height[freeRect] = freeRectangles.height[last];
+        freeNodes[freeRect] = freeNodes[last];
+        splitNodes[freeNodes[freeRect]].freeRect = freeRect;
+        LinkSizeClass(freeRect);
     }
+    freeRectangles.pop_back();
+    freeNodes.pop_back();
+}
 
-    // Perform the actual split.
-    SplitFreeRectAlongAxis(freeRect, placedRect, splitHorizontal);
+void GuillotineBinPack::PlaceInFreeNode(int freeRect, const Rect &newRect, int rectId)
+{
+    int node = freeNodes[freeRect];
+    const Rect freeArea = freeRectangles[freeRect];
+    RemoveFreeNode(node);
+
+    // The same two rectangles SplitFreeRectAlongAxis leaves, as two levels of the tree: first the strip
+    // that holds newRect and the rest of the free rectangle, then newRect and the rest of the strip.
+    Rect strip = freeArea, rest = freeArea, beside = freeArea;
+    if (SplitHorizontalByHeuristic(freeArea, newRect, defaultSplitMethod))
+    {
+        strip.height = newRect.height;
+        rest.y += newRect.height;
+        rest.height -= newRect.height;
+        beside.x += newRect.width;
+        beside.width -= newRect.width;
+        beside.height = newRect.height;
+    }
+    else
+    {
+        strip.width = newRect.width;
+        rest.x += newRect.width;
+        rest.width -= newRect.width;
+        beside.y += newRect.height;
+        beside.height -= newRect.height;
+        beside.width = newRect.width;
+    }
+    const Rect parts[2] = { rest, beside };
+    const Rect kept[2] = { strip, newRect };
+    for(int level = 0; level < 2; ++level)
+    {
+        // Empty parts leave the node as it is.
+        if (parts[level].width <= 0 || parts[level].height <= 0)
+            continue;
+        const int keptNode = NewSplitNode(kept[level], node);
+        const int partNode = NewSplitNode(parts[level], node);
+        splitNodes[node].children[0] = keptNode;
+        splitNodes[node].children[1] = partNode;
+        AddFreeNode(partNode);
+        node = keptNode;
+    }
+    splitNodes[node].rectId = rectId;
+    usedNodes[rectId] = node;
+}
+
+void GuillotineBinPack::FreeSplitNode(int node)
+{
+    splitNodes[node].rectId = -1;
+    AddFreeNode(node);
+
+    // Merge the node with its sibling while both are free, back up the splits that made them.
+    while(splitNodes[node].parent >= 0)
+    {
+        const int parent = splitNodes[node].parent;
+        const int first = splitNodes[parent].children[0];
+        const int second = splitNodes[parent].children[1];
+        if (splitNodes[first].freeRect < 0 || splitNodes[second].freeRect < 0)
+            break;
+        RemoveFreeNode(first);
+        RemoveFreeNode(second);
+        releasedNodes.push_back(first);
+        releasedNodes.push_back(second);
+        splitNodes[parent].children[0] = splitNodes[parent].children[1] = -1;
+        AddFreeNode(parent);
+        node = parent;
+    }
+}
+
+int GuillotineBinPack::FindSizeClassFit(int width, int height, int *level, int *score) const
+{
+    const int minW = SizeClass(width);
+    const int minH = SizeClass(height);
+    // Free rectangles in smaller classes are too small. Try the classes in order of the sum of their width and
+    // height classes, which roughly doubles the area at each step.
+    for(int sum = minW + minH; sum <= 2 * (SizeClasses - 1); ++sum)
+    {
+        int bestIndex = -1;
+        int bestScore = std::numeric_limits<int>::max();
+        for(int w = max(minW, sum - (SizeClasses - 1)); w <= min(SizeClasses - 1, sum - minH); ++w)
+        {
+            const int h = sum - w;
+            if ((freeClassMask[w] & (1u << h)) == 0)
+                continue;
+            // Sides in the same class as the rectangle's may still be too short.
+            int fits = 0;
+            for(int i = freeClassHead[w][h]; i >= 0 && fits < MaxClassScan; i = freeClassNext[i])
+            {
+                const int freeWidth = freeRectangles.width[i];
+                const int freeHeight = freeRectangles.height[i];
+                if (width > freeWidth || height > freeHeight)
+                    continue;
+                ++fits;
+                int s = ScoreByHeuristic(width, height, freeWidth, freeHeight, defaultRectChoice);
+                if (s < bestScore)
+                {
+                    bestIndex = i;
+                    bestScore = s;
+                }
+            }
+        }
+        if (bestIndex >= 0)
+        {
+            *level = sum;
+            *score = bestScore;
+            return bestIndex;
+        }
+    }
+    return -1;
+}
+
+/// @return True if r fits inside freeRect (possibly rotated).
+bool Fits(const RectSize &r, const Rect &freeRect)
+{
+    return (r.width <= freeRect.width && r.height <= freeRect.height) ||
+        (r.height <= freeRect.width && r.width <= freeRect.height);
+}
+
+/// @return True if r fits perfectly inside freeRect, i.e. the leftover area is 0.
+bool FitsPerfectly(const RectSize &r, const Rect &freeRect)
+{
+    return (r.width == freeRect.width && r.height == freeRect.height) ||
+        (r.height == freeRect.width && r.width == freeRect.height);
+}
+
+void GuillotineBinPack::SplitFreeRectByHeuristic(const Rect &freeRect, const Rect &placedRect, GuillotineSplitHeuristic method)
+{
+    SplitFreeRectAlongAxis(freeRect, placedRect, SplitHorizontalByHeuristic(freeRect, placedRect, method));
 }
 
 /// This function will add the two generated rectangles into the freeRectangles array. The caller is expected to
@@ -316,42 +978,96 @@ void GuillotineBinPack::SplitFreeRectAlongAxis(const Rect &freeRect, const Rect
         freeRectangles.push_back(right);
 }
 
+void GuillotineBinPack::CarveFreeRects(const Rect &occupied)
+{
+    FreeRectList carved;
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        Rect freeRect = freeRectangles[i];
+        if (occupied.x >= freeRect.x + freeRect.width || occupied.x + occupied.width <= freeRect.x ||
+            occupied.y >= freeRect.y + freeRect.height || occupied.y + occupied.height <= freeRect.y)
+        {
+            carved.push_back(freeRect);
+            continue;
+        }
+
+        int top = std::max(freeRect.y, occupied.y);
+        int bottom = std::min(freeRect.y + freeRect.height, occupied.y + occupied.height);
+        Rect part = freeRect;
+        if (occupied.y > freeRect.y)
+        {
+            part.y = freeRect.y;
+            part.height = occupied.y - freeRect.y;
+            carved.push_back(part);
+        }
+        if (bottom < freeRect.y + freeRect.height)
+        {
+            part.y = bottom;
+            part.height = freeRect.y + freeRect.height - bottom;
+            carved.push_back(part);
+        }
+        part.y = top;
+        part.height = bottom - top;
+        if (occupied.x > freeRect.x)
+        {
+            part.x = freeRect.x;
+            part.width = occupied.x - freeRect.x;
+            carved.push_back(part);
+        }
+        if (occupied.x + occupied.width < freeRect.x + freeRect.width)
+        {
+            part.x = occupied.x + occupied.width;
+            part.width = freeRect.x + freeRect.width - part.x;
+            carved.push_back(part);
+        }
+    }
+    freeRectangles = carved;
+    onlineValid = false;
+}
+
 void GuillotineBinPack::MergeFreeList()
 {
+    onlineValid = false;
+
+    std::vector<int> &x = freeRectangles.x;
+    std::vector<int> &y = freeRectangles.y;
+    std::vector<int> &width = freeRectangles.width;
+    std::vector<int> &height = freeRectangles.height;
+
     // Do a Theta(n^2) loop to see if any pair of free rectangles could me merged into one.
     // Note that we miss any opportunities to merge three rectangles into one. (should call this function again to detect that)
     for(size_t i = 0; i < freeRectangles.size(); ++i)
         for(size_t j = i+1; j < freeRectangles.size(); ++j)
         {
-            if (freeRectangles[i].width == freeRectangles[j].width && freeRectangles[i].x == freeRectangles[j].x)
+            if (width[i] == width[j] && x[i] == x[j])
             {
-                if (freeRectangles[i].y == freeRectangles[j].y + freeRectangles[j].height)
+                if (y[i] == y[j] + height[j])
                 {
-                    freeRectangles[i].y -= freeRectangles[j].height;
-                    freeRectangles[i].height += freeRectangles[j].height;
-                    freeRectangles.erase(freeRectangles.begin() + j);
+                    y[i] -= height[j];
+                    height[i] += height[j];
+                    freeRectangles.erase(j);
                     --j;
                 }
-                else if (freeRectangles[i].y + freeRectangles[i].height == freeRectangles[j].y)
+                else if (y[i] + height[i] == y[j])
                 {
-                    freeRectangles[i].height += freeRectangles[j].height;
-                    freeRectangles.erase(freeRectangles.begin() + j);
+                    height[i] += height[j];
+                    freeRectangles.erase(j);
                     --j;
                 }
             }
-            else if (freeRectangles[i].height == freeRectangles[j].height && freeRectangles[i].y == freeRectangles[j].y)
+            else if (height[i] == height[j] && y[i] == y[j])
             {
-                if (freeRectangles[i].x == freeRectangles[j].x + freeRectangles[j].width)
+                if (x[i] == x[j] + width[j])
                 {
-                    freeRectangles[i].x -= freeRectangles[j].width;
-                    freeRectangles[i].width += freeRectangles[j].width;
-                    freeRectangles.erase(freeRectangles.begin() + j);
+                    x[i] -= width[j];
+                    width[i] += width[j];
+                    freeRectangles.erase(j);
                     --j;
                 }
-                else if (freeRectangles[i].x + freeRectangles[i].width == freeRectangles[j].x)
+                else if (x[i] + width[i] == x[j])
                 {
-                    freeRectangles[i].width += freeRectangles[j].width;
-                    freeRectangles.erase(freeRectangles.begin() + j);
+                    width[i] += width[j];
+                    freeRectangles.erase(j);
                     --j;
                 }
             }
@@ -11,13 +11,49 @@
 
 #include <vector>
 
-#include "Rect.h"
+#include "BinPack.h"
 
 namespace rbp {
 
+/// A list of free rectangles stored as separate arrays of each coordinate, so a scan over the list can score
+/// several rectangles per instruction. It has the part of the std::vector interface the packers use.
+class FreeRectList
+{
+public:
+    size_t size() const { return x.size(); }
+    bool empty() const { return x.empty(); }
+
+    /// Empties the list, keeping the capacity of the arrays.
+    void clear() { x.clear(); y.clear(); width.clear(); height.clear(); }
+
+    void push_back(const Rect &r) { x.push_back(r.x); y.push_back(r.y); width.push_back(r.width); height.push_back(r.height); }
+    void pop_back() { x.pop_back(); y.pop_back(); width.pop_back(); height.pop_back(); }
+
+    /// Returns a copy of the i-th rectangle.
+    Rect operator[](size_t i) const
+    {
+        Rect r = { x[i], y[i], width[i], height[i], nullptr, false };
+        return r;
+    }
+
+    /// Removes the i-th rectangle, keeping the order of the rest.
+    void erase(size_t i)
+    {
+        x.erase(x.begin() + i);
+        y.erase(y.begin() + i);
+        width.erase(width.begin() + i);
+        height.erase(height.begin() + i);
+    }
+
+    std::vector<int> x;
+    std::vector<int> y;
+    std::vector<int> width;
+    std::vector<int> height;
+};
+
 /** GuillotineBinPack implements different variants of bin packer algorithms that use the GUILLOTINE data structure
     to keep track of the free space of the bin where rectangles may be placed. */
-class GuillotineBinPack
+class GuillotineBinPack : public BinPack
 {
 public:
     /// The initial bin size will be (0,0). Call Init to set the bin size.
@@ -28,7 +64,13 @@ public:
 
     /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
     /// you need to restart with a new bin.
-    void Init(int width, int height);
+    void Init(int width, int height) override;
+
+    /// (Re)initializes the packer to a bin of width x height units where the given rectangles are already taken, like
+    /// images pinned to fixed places or areas reserved for other content. The free rectangles are cut around them.
+    /// The ones with an image are added to the used rectangles, the others only cover their area. All of them count
+    /// in the occupied area, and they must lie inside the bin without overlapping each other.
+    void Init(int width, int height, const std::vector<Rect> &occupied);
 
     /// Specifies the different choice heuristics that can be used when deciding which of the free subrectangles
     /// to place the to-be-packed rectangle into.
@@ -54,66 +96,241 @@ public:
         SplitLongerAxis ///< -LAS
     };
 
+    /// Sets the heuristics used by the BinPack interface version of Insert. The defaults are
+    /// RectBestShortSideFit and SplitShorterLeftoverAxis with merging enabled.
+    void SetHeuristics(FreeRectChoiceHeuristic rectChoice, GuillotineSplitHeuristic splitMethod, bool merge);
+
+    /// Sets whether the batch Insert runs a loop compiled for its heuristics, the default, or a generic loop
+    /// that switches on them for every score. The results are the same, the generic loop is only for comparison.
+    void SetSpecializedLoops(bool enable) { specializedLoops = enable; }
+
+    /// Sets whether the batch Insert places the rectangles of the same size together, the default. When the chosen
+    /// free rectangle fits them exactly across, a placement fills it with a row or column of them instead of one.
+    void SetGroupPlacement(bool enable) { groupPlacement = enable; }
+
+    /// Inserts a list of rectangles into the bin using the heuristics given to SetHeuristics.
+    bool Insert(std::vector<RectSize> &rects, bool flip) override;
+
+    /// Inserts a single rectangle into the bin using the heuristics given to SetHeuristics.
+    Rect Insert(const RectSize &rect, bool flip) override;
+
+    /// Enlarges the bin, the new strip of space becomes a free rectangle.
+    void Grow(int width, int height) override;
+
     /// Inserts a list of rectangles into the bin.
-    /// @param rects The list of rectangles to add. This list will be destroyed in the packing process.
+    /// @param rects The list of rectangles to add. Placed rectangles are removed from it.
     /// @param merge If true, performs Rectangle Merge operations during the packing process.
     /// @param flip If true, Rectangles may be flipped for more optimal packing.
     /// @param rectChoice The free rectangle choice heuristic rule to use.
     /// @param splitMethod The free rectangle split heuristic rule to use.
     /// @return true if all rectangles fit, false if a rectangle couldn't be placed
-    bool Insert(std::vector<RectSize> rects, bool merge, bool flip,
+    bool Insert(std::vector<RectSize> &rects, bool merge, bool flip,
         FreeRectChoiceHeuristic rectChoice, GuillotineSplitHeuristic splitMethod);
 
-    /// Computes the ratio of used/total surface area. 0.00 means no space is yet used, 1.00 means the whole bin is used.
-    float Occupancy() const;
+    /// Inserts a single rectangle into the bin, possibly rotated.
+    /// @return The placed rectangle, with height 0 if it did not fit.
+    Rect Insert(int width, int height, bool merge, bool flip, FreeRectChoiceHeuristic rectChoice,
+        GuillotineSplitHeuristic splitMethod);
 
-    /// Returns the internal list of disjoint rectangles that track the free area of the bin. You may alter this vector
-    /// any way desired, as long as the end result still is a list of disjoint rectangles.
-    std::vector<Rect> &GetFreeRectangles() { return freeRectangles; }
+    /// Inserts a single rectangle into a bin that fills up over time, like a runtime glyph cache. Instead of scoring
+    /// every free rectangle, it looks in lists of free rectangles by size class, smallest classes first, and the
+    /// choice heuristic given to SetHeuristics only ranks the few fits in the first class that has any. Free
+    /// rectangles are not merged. The lists are built on the first call after any other change to the bin, and
+    /// later calls do not allocate, except to grow the free and used rectangle lists beyond their capacity.
+    /// @param rectId [out] If not null, receives the id of the placed rectangle, its index in GetUsedRectangles().
+    /// @return The placed rectangle, with height 0 if it did not fit.
+    Rect TryInsert(int width, int height, bool flip, int *rectId = nullptr);
+
+    /// Removes a rectangle, given its id, and merges its area back with the free space along the splits TryInsert
+    /// made, as far as that space is free. Rectangles placed in other ways are freed without merging. The rectangle
+    /// stays in GetUsedRectangles() with zero size until TryInsert reuses its id.
+    void Remove(int rectId);
+
+    /// A rectangle moved by Defragment. Its contents must be copied from the old to the new place.
+    struct RectMove
+    {
+        int rectId;
+        Rect from;
+        Rect to;
+    };
 
-    /// Returns the list of packed rectangles. You may alter this vector at will, for example, you can move a Rect from
-    /// this list to the Free Rectangles list to free up space on-the-fly, but notice that this causes fragmentation.
-    std::vector<Rect> &GetUsedRectangles() { return usedRectangles; }
+    /// Moves up to maxMoves rectangles out of the way of free space. A rectangle is moved when freeing it merges
+    /// a block of free space bigger than the free rectangle it moves into, so the free space gathers into fewer and
+    /// bigger rectangles. Each call tries at most 4 * maxMoves rectangles, continuing where the previous call left
+    /// off, so it can run a little every frame.
+    /// @param moves [out] The moves done are appended to it. Copy the contents of the rectangles in the same order.
+    /// @return The number of rectangles moved.
+    int Defragment(int maxMoves, std::vector<RectMove> &moves);
+
+    /// Returns how fragmented the free area is: 0 when the largest free rectangle is all of it, closer to 1 as
+    /// that rectangle becomes a smaller part.
+    float Fragmentation() const;
+
+    /// Returns the internal list of disjoint rectangles that track the free area of the bin. You may alter this list
+    /// any way desired, as long as the end result still is a list of disjoint rectangles.
+    FreeRectList &GetFreeRectangles() { onlineValid = false; return freeRectangles; }
+    const FreeRectList &GetFreeRectangles() const { return freeRectangles; }
 
     /// Performs a Rectangle Merge operation. This procedure looks for adjacent free rectangles and merges them if they
     /// can be represented with a single rectangle. Takes up Theta(|freeRectangles|^2) time.
     void MergeFreeList();
 
-    int GetWidth() const { return binWidth; }
-    int GetHeight() const { return binHeight; }
-    int GetOccupiedWidth() const { return occupiedWidth; }
-    int GetOccupiedHeight() const { return occupiedHeight; }
-
 private:
-    int binWidth;
-    int binHeight;
+    /// Heuristics used by the BinPack interface.
+    FreeRectChoiceHeuristic defaultRectChoice;
+    GuillotineSplitHeuristic defaultSplitMethod;
+    bool defaultMerge;
+    bool specializedLoops;
+    bool groupPlacement;
 
-    int occupiedWidth;
-    int occupiedHeight;
+    /// Stores a list of rectangles that represents the free area of the bin. This rectangles in this list are disjoint.
+    FreeRectList freeRectangles;
 
-    /// Stores a list of all the rectangles that we have packed so far. This is used only to compute the Occupancy ratio,
-    /// so if you want to have the packer consume less memory, this can be removed.
-    std::vector<Rect> usedRectangles;
+    /// Scratch array with the score of each free rectangle for the rectangle being scored.
+    std::vector<int> freeScores;
 
-    /// Stores a list of rectangles that represents the free area of the bin. This rectangles in this list are disjoint.
-    std::vector<Rect> freeRectangles;
+    /// Groups of the rectangles of the same size in a batch Insert. The indices of the rectangles of each group are
+    /// in sizeGroupRects, in order, from sizeGroupNext, the first one not placed yet, to sizeGroupEnd.
+    std::vector<int> sizeGroupOf;
+    std::vector<int> sizeGroupRects;
+    std::vector<int> sizeGroupNext;
+    std::vector<int> sizeGroupEnd;
+
+    /// Scratch array with the pending list positions of the rectangles placed together.
+    std::vector<size_t> groupPositions;
 
-    static int ScoreByHeuristic(int width, int height, const Rect &freeRect, FreeRectChoiceHeuristic rectChoice);
-    // The following functions compute (penalty) score values if a rect of the given size was placed into the 
-    // given free rectangle. In these score values, smaller is better.
+    /// Number of size classes of each side. Sides of 2^(SizeClasses-1) and longer share the last class.
+    static const int SizeClasses = 16;
 
-    static int ScoreBestAreaFit(int width, int height, const Rect &freeRect);
-    static int ScoreBestShortSideFit(int width, int height, const Rect &freeRect);
-    static int ScoreBestLongSideFit(int width, int height, const Rect &freeRect);
+    /// Number of fitting free rectangles of a size class that TryInsert ranks before it stops looking.
+    static const int MaxClassScan = 8;
 
-    static int ScoreWorstAreaFit(int width, int height, const Rect &freeRect);
-    static int ScoreWorstShortSideFit(int width, int height, const Rect &freeRect);
-    static int ScoreWorstLongSideFit(int width, int height, const Rect &freeRect);
+    /// Lists of the free rectangles by size class of their width and height, linked through freeClassNext and
+    /// freeClassPrev. Used by TryInsert, and only valid while onlineValid is true.
+    int freeClassHead[SizeClasses][SizeClasses];
+    /// Bit h of freeClassMask[w] is set when the list of width class w and height class h is not empty.
+    unsigned freeClassMask[SizeClasses];
+    std::vector<int> freeClassNext;
+    std::vector<int> freeClassPrev;
+
+    /// A node of the tree of splits made by TryInsert. A node is split in two children, or holds a free or a
+    /// used rectangle.
+    struct SplitNode
+    {
+        int x, y, width, height;
+        int parent;
+        int children[2];
+        int freeRect; ///< Index in freeRectangles, or -1.
+        int rectId; ///< Index in usedRectangles, or -1.
+    };
+    std::vector<SplitNode> splitNodes;
+    /// Nodes merged back into their parents, for reuse.
+    std::vector<int> releasedNodes;
+    /// Node of each free rectangle and of each used rectangle, -1 for removed ones.
+    std::vector<int> freeNodes;
+    std::vector<int> usedNodes;
+
+    /// Whether the size classes and split tree match the free and used rectangles.
+    bool onlineValid;
+
+    /// Ids of removed rectangles, for TryInsert to reuse.
+    std::vector<int> removedIds;
+
+    /// Id of the next rectangle Defragment tries to move.
+    size_t defragCursor;
+
+    /// Returns the size class of a side, floor(log2(side)).
+    static int SizeClass(int side);
+
+    /// Puts every free rectangle in the list of its size class, and makes each free and used rectangle the root
+    /// of its own split tree.
+    void BuildOnlineState();
+
+    void LinkSizeClass(int freeRect);
+    void UnlinkSizeClass(int freeRect);
+
+    int NewSplitNode(const Rect &r, int parent);
+
+    /// Adds the rectangle of a node to the free list and its size class.
+    void AddFreeNode(int node);
+
+    /// Removes the free rectangle of a node from the free list and its size class. The last free rectangle moves
+    /// into its place.
+    void RemoveFreeNode(int node);
+
+    /// Places newRect with the given id at the corner of a free rectangle, splitting its node.
+    void PlaceInFreeNode(int freeRect, const Rect &newRect, int rectId);
+
+    /// Frees the rectangle of a node, and merges it with its sibling while both are free.
+    void FreeSplitNode(int node);
+
+    /// Looks for a free rectangle to place a rectangle of the given size into, in the size classes that could fit it,
+    /// smallest first.
+    /// @param level [out] Sum of the width and height classes of the free rectangle found.
+    /// @param score [out] Score of the placement with the choice heuristic.
+    /// @return The index of the free rectangle, or -1 if none fits.
+    int FindSizeClassFit(int width, int height, int *level, int *score) const;
+
+    /// Goes through the list of free rectangles and finds the best one to place a rectangle of given size into.
+    /// @param nodeIndex [out] The index of the free rectangle in the freeRectangles array into which the new
+    ///        rect was placed.
+    /// @return A Rect structure that represents the placement of the new rect into the best free rectangle.
+    Rect FindPositionForNewNode(int width, int height, bool flip, FreeRectChoiceHeuristic rectChoice, int *nodeIndex);
+
+    struct RuntimeHeuristics;
+    template<FreeRectChoiceHeuristic rectChoice, GuillotineSplitHeuristic splitMethod> struct FixedHeuristics;
+
+    /// Dispatches the batch Insert to the loop instantiated for the split heuristic.
+    template<FreeRectChoiceHeuristic rectChoice>
+    bool InsertFixedChoice(std::vector<RectSize> &rects, bool merge, bool flip, GuillotineSplitHeuristic splitMethod);
+
+    /// Groups the rectangles of a batch Insert by size.
+    void BuildSizeGroups(const std::vector<RectSize> &rects);
+
+    /// The batch Insert loop, scoring and splitting with the given heuristics.
+    template<class Heuristics>
+    bool InsertLoop(std::vector<RectSize> &rects, bool merge, bool flip, const Heuristics &heuristics);
+
+    /// Number of free rectangles the batch Insert scores at once before checking for a perfect fit. Each block
+    /// after the first is twice as big as the one before.
+    static const size_t FirstFreeBlockSize = 8;
+
+    /// Scores a rectangle of the given size against the free rectangles [begin, end) into the same entries of
+    /// freeScores. A perfect fit scores std::numeric_limits<int>::min(), and a free rectangle it does not fit max().
+    /// @return The smallest score.
+    template<class Heuristics>
+    int ScoreFreeRects(int width, int height, bool flip, size_t begin, size_t end, const Heuristics &heuristics);
+
+    /// Returns the first free rectangle from begin on with the given score in freeScores.
+    size_t FindFreeScore(int score, size_t begin) const;
+
+    /// Returns whether a rectangle of the given size goes flipped into the i-th free rectangle, as scored by
+    /// ScoreFreeRects.
+    bool FitsFlipped(int width, int height, bool flip, size_t i) const;
+
+    static int ScoreByHeuristic(int width, int height, int freeWidth, int freeHeight, FreeRectChoiceHeuristic rectChoice);
+    // The following functions compute (penalty) score values if a rect of the given size was placed into a
+    // free rectangle of the given size. In these score values, smaller is better.
+
+    static int ScoreBestAreaFit(int width, int height, int freeWidth, int freeHeight);
+    static int ScoreBestShortSideFit(int width, int height, int freeWidth, int freeHeight);
+    static int ScoreBestLongSideFit(int width, int height, int freeWidth, int freeHeight);
+
+    static int ScoreWorstAreaFit(int width, int height, int freeWidth, int freeHeight);
+    static int ScoreWorstShortSideFit(int width, int height, int freeWidth, int freeHeight);
+    static int ScoreWorstLongSideFit(int width, int height, int freeWidth, int freeHeight);
+
+    /// Cuts the free rectangles that overlap the given rectangle into the parts around it: the full width strips
+    /// above and below it, and the parts left and right of it between them.
+    void CarveFreeRects(const Rect &occupied);
 
     /// Splits the given L-shaped free rectangle into two new free rectangles after placedRect has been placed into it.
     /// Determines the split axis by using the given heuristic.
     void SplitFreeRectByHeuristic(const Rect &freeRect, const Rect &placedRect, GuillotineSplitHeuristic method);
 
+    /// Returns whether the given heuristic splits the L-shaped free area horizontally.
+    static bool SplitHorizontalByHeuristic(const Rect &freeRect, const Rect &placedRect, GuillotineSplitHeuristic method);
+
     /// Splits the given L-shaped free rectangle into two new free rectangles along the given fixed split axis.
     void SplitFreeRectAlongAxis(const Rect &freeRect, const Rect &placedRect, bool splitHorizontal);
 };
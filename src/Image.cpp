@@ -24,6 +24,9 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include "Image.h"
 
+#include <vector>
+#include <algorithm>
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include "stb_image.c"
@@ -31,7 +34,7 @@
 // ------------------
 // Image
 // ------------------
-Image::Image(int _w, int _h, int _ncomps): data(nullptr), w(0), h(0), ncomps(0) {
+Image::Image(int _w, int _h, int _ncomps): data(nullptr), w(0), h(0), ncomps(0), cellSize(0), cellCols(0), cellRows(0) {
     int size = _w*_h*_ncomps;
     if (size > 0) {
         data = std::shared_ptr<unsigned char>((unsigned char *)calloc(size, 1), free);
@@ -105,6 +108,7 @@ void Image::FindFillArea() {
     }
     if (fillh < 0) {
         filly = 0;
+        fillh = 0;
     }
     // Left
     fillx = -1;
@@ -136,6 +140,203 @@ void Image::FindFillArea() {
     }
 }
 
+// The alpha of the rows that reach a row of cells is or'ed together a whole row of the fill area at a time, in
+// a loop the compiler vectorizes, and then over the columns that reach each cell. The sizes are copied to locals,
+// as the byte stores could otherwise alias them and keep the loop from being vectorized. Without alpha, every cell
+// has content.
+void Image::FindCellMask(int size, int padx, int pady) {
+    cellSize = size;
+    cellCols = (fillw + padx + size - 1) / size;
+    cellRows = (fillh + pady + size - 1) / size;
+    cellMask.assign(cellCols*cellRows, ncomps == 4? 0 : 1);
+    if (ncomps != 4) {
+        return;
+    }
+    int fw = fillw;
+    int fh = fillh;
+    int cols = cellCols;
+    std::vector<unsigned char> alpha(fw);
+    for (int cy = 0; cy < cellRows; ++cy) {
+        std::fill(alpha.begin(), alpha.end(), 0);
+        int y0 = std::max(cy*size - pady, 0);
+        int y1 = std::min((cy + 1)*size, fh);
+        unsigned char *pa = alpha.data();
+        for (int y = y0; y < y1; ++y) {
+            const unsigned char *ps = at(fillx, filly + y) + 3;
+            for (int j = 0; j < fw; ++j) {
+                pa[j] |= ps[j*4];
+            }
+        }
+        for (int cx = 0; cx < cols; ++cx) {
+            unsigned char any = 0;
+            int x1 = std::min((cx + 1)*size, fw);
+            for (int x = std::max(cx*size - padx, 0); x < x1; ++x) {
+                any |= pa[x];
+            }
+            cellMask[cy*cols + cx] = any != 0;
+        }
+    }
+}
+
+static inline uint64_t MixHash(uint64_t h, uint64_t v) {
+    h ^= v * 0x9E3779B97F4A7C15ull;
+    h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ull;
+    return h ^ (h >> 27);
+}
+
+// Hash the fill area 8 bytes at a time, rows are mixed separately since they are not contiguous
+uint64_t Image::HashFillArea() const {
+    uint64_t h = MixHash(MixHash(0, fillw), ((uint64_t)fillh << 8) | ncomps);
+    if (fillw <= 0 || fillh <= 0) {
+        return h;
+    }
+    size_t rowSize = (size_t)fillw*ncomps;
+    for (int i = 0; i < fillh; ++i) {
+        const unsigned char *ps = at(fillx, filly+i);
+        size_t j = 0;
+        uint64_t v;
+        for (; j + 8 <= rowSize; j += 8) {
+            memcpy(&v, ps+j, 8);
+            h = MixHash(h, v);
+        }
+        v = 0;
+        memcpy(&v, ps+j, rowSize-j);
+        h = MixHash(h, v ^ rowSize);
+    }
+    return h;
+}
+
+// Each pixel is mixed and weighted by A^y * B^x of its position once transformed. Transforms only reverse or swap
+// the x and y weights, so four weighted sums of each row, forward and backward with both bases, give all 8 hashes
+// in a single pass over the pixels. The row sums are plain multiply-add loops that vectorize.
+void Image::HashFillAreaTransforms(uint64_t hashes[NUM_TRANSFORMS]) const {
+    const uint32_t A = 0x9E3779B1u, B = 0x85EBCA77u;
+    int fw = std::max(fillw, 0);
+    int fh = std::max(fillh, 0);
+    int n = std::max(fw, fh);
+    std::vector<uint32_t> powA(n), powB(n), revPowA(fw), revPowB(fw), pixels(fw);
+    for (int i = 0; i < n; ++i) {
+        powA[i] = i == 0? 1 : powA[i-1]*A;
+        powB[i] = i == 0? 1 : powB[i-1]*B;
+    }
+    for (int j = 0; j < fw; ++j) {
+        revPowA[j] = powA[fw-1-j];
+        revPowB[j] = powB[fw-1-j];
+    }
+    uint32_t sums[NUM_TRANSFORMS] = {0};
+    for (int i = 0; i < fh; ++i) {
+        const unsigned char *ps = at(fillx, filly+i);
+        if (ncomps == 4) {
+            memcpy(pixels.data(), ps, fw*4);
+        } else {
+            for (int j = 0; j < fw; ++j, ps += ncomps) {
+                uint32_t p = 0;
+                for (int k = 0; k < ncomps; ++k) {
+                    p |= (uint32_t)ps[k] << (k*8);
+                }
+                pixels[j] = p;
+            }
+        }
+        uint32_t fwdB = 0, revB = 0, fwdA = 0, revA = 0;
+        for (int j = 0; j < fw; ++j) {
+            uint32_t g = pixels[j];
+            g = (g ^ (g >> 16)) * 0x45D9F3Bu;
+            g ^= g >> 16;
+            fwdB += g*powB[j];
+            revB += g*revPowB[j];
+            fwdA += g*powA[j];
+            revA += g*revPowA[j];
+        }
+        // Without transpose the row index weighs with A, after it the row becomes a column and weighs with B
+        uint32_t a = powA[i], ra = powA[fh-1-i], b = powB[i], rb = powB[fh-1-i];
+        sums[0] += a*fwdB;
+        sums[TRANSFORM_FLIP_X] += a*revB;
+        sums[TRANSFORM_FLIP_Y] += ra*fwdB;
+        sums[TRANSFORM_FLIP_X | TRANSFORM_FLIP_Y] += ra*revB;
+        sums[TRANSFORM_TRANSPOSE] += b*fwdA;
+        sums[TRANSFORM_TRANSPOSE | TRANSFORM_FLIP_X] += rb*fwdA;
+        sums[TRANSFORM_TRANSPOSE | TRANSFORM_FLIP_Y] += b*revA;
+        sums[TRANSFORM_TRANSPOSE | TRANSFORM_FLIP_X | TRANSFORM_FLIP_Y] += rb*revA;
+    }
+    for (int t = 0; t < NUM_TRANSFORMS; ++t) {
+        bool transpose = (t & TRANSFORM_TRANSPOSE) != 0;
+        uint64_t size = transpose? ((uint64_t)fh << 32) | fw : ((uint64_t)fw << 32) | fh;
+        hashes[t] = MixHash(MixHash(sums[t], size), ncomps);
+    }
+}
+
+bool Image::SameFillArea(const Image &other, int transform) const {
+    bool transpose = (transform & TRANSFORM_TRANSPOSE) != 0;
+    int tw = transpose? fillh : fillw;
+    int th = transpose? fillw : fillh;
+    if (tw != other.fillw || th != other.fillh || ncomps != other.ncomps) {
+        return false;
+    }
+    if (fillw <= 0 || fillh <= 0) {
+        return true;
+    }
+    if (transform == 0) {
+        size_t rowSize = (size_t)fillw*ncomps;
+        for (int i = 0; i < fillh; ++i) {
+            if (memcmp(at(fillx, filly+i), other.at(other.fillx, other.filly+i), rowSize) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+    for (int i = 0; i < fillh; ++i) {
+        const unsigned char *ps = at(fillx, filly+i);
+        for (int j = 0; j < fillw; ++j, ps += ncomps) {
+            int x = transpose? i : j;
+            int y = transpose? j : i;
+            if (transform & TRANSFORM_FLIP_X) x = tw-1-x;
+            if (transform & TRANSFORM_FLIP_Y) y = th-1-y;
+            if (memcmp(ps, other.at(other.fillx+x, other.filly+y), ncomps) != 0) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool Image::ContainsFillArea(const Image &other, int x, int y) const {
+    if (ncomps != other.ncomps || x < 0 || y < 0 || x + other.fillw > fillw || y + other.fillh > fillh) {
+        return false;
+    }
+    size_t rowSize = (size_t)std::max(other.fillw, 0)*ncomps;
+    for (int i = 0; i < other.fillh; ++i) {
+        if (memcmp(at(fillx+x, filly+y+i), other.at(other.fillx, other.filly+i), rowSize) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Image::BlitOpaque(const Image &src, int x, int y, int srcx, int srcy, int srcw, int srch) {
+    if (src.ncomps != 4 || ncomps != 4) {
+        Blit(src, x, y, srcx, srcy, srcw, srch);
+        return;
+    }
+    // Clip the source and the destination as Blit does
+    if (srcx < 0) { x += -srcx; srcw -= -srcx; srcx = 0; }
+    if (srcy < 0) { y += -srcy; srch -= -srcy; srcy = 0; }
+    if (srcx + srcw > src.w) srcw = src.w - srcx;
+    if (srcy + srch > src.h) srch = src.h - srcy;
+    if (x < 0) { srcx += -x; srcw -= -x; x = 0; }
+    if (y < 0) { srcy += -y; srch -= -y; y = 0; }
+    if (x + srcw > w) srcw = w - x;
+    if (y + srch > h) srch = h - y;
+    for (int i = 0; i < srch; ++i) {
+        unsigned char *pd = at(x, y + i);
+        const unsigned char *ps = src.at(srcx, srcy + i);
+        for (int j = 0; j < srcw; ++j, pd += 4, ps += 4) {
+            if (ps[3] != 0) {
+                memcpy(pd, ps, 4);
+            }
+        }
+    }
+}
+
 void Image::Blit(const Image &src, int x, int y, int srcx, int srcy, int srcw, int srch) {
     // Clip source
     if (srcx < 0) { x += -srcx; srcw -= -srcx; srcx = 0; }
@@ -25,18 +25,34 @@
 #define INCLUDE_IMAGE_H
 
 #include <string>
+#include <vector>
 #include <memory>
+#include <cstdint>
 
 struct Image {
+    // The 8 rotations and mirrors of an image: transpose it (swap x and y) first, then mirror it horizontally and
+    // vertically. Rotating 90 deg clockwise is TRANSFORM_TRANSPOSE | TRANSFORM_FLIP_X.
+    enum Transform {
+        TRANSFORM_FLIP_X = 1,
+        TRANSFORM_FLIP_Y = 2,
+        TRANSFORM_TRANSPOSE = 4,
+        NUM_TRANSFORMS = 8,
+    };
+
     std::shared_ptr<unsigned char> data;
     int w;
     int h;
     int ncomps;
     std::string filename;
     int fillx, filly, fillw, fillh;
+    // Which square cells of cellSize pixels over the fill area and its padding, right and below, have pixels that
+    // are not transparent or are within the padding of one, row by row, cellCols by cellRows. Empty until
+    // FindCellMask.
+    int cellSize, cellCols, cellRows;
+    std::vector<unsigned char> cellMask;
 
-    Image(): data(nullptr), w(0), h(0), ncomps(0) { ResetFillArea(); }
-    Image(const char *_filename): data(nullptr), w(0), h(0), ncomps(0), fillw(0), fillh(0) {
+    Image(): data(nullptr), w(0), h(0), ncomps(0), cellSize(0), cellCols(0), cellRows(0) { ResetFillArea(); }
+    Image(const char *_filename): data(nullptr), w(0), h(0), ncomps(0), fillw(0), fillh(0), cellSize(0), cellCols(0), cellRows(0) {
         Read(_filename);
     }
     Image(int _w, int _h, int _ncomps);
@@ -55,9 +71,22 @@ struct Image {
          fillh = h;
     }
     void FindFillArea();
+    void FindCellMask(int size, int padx, int pady);
+
+    // 64 bit hash of the pixels inside the fill area, equal for images with the same fill area pixels
+    uint64_t HashFillArea() const;
+    // Hashes of the fill area under each transform, hashes[t] of an image is equal to hashes[0] of its fill area
+    // transformed by t
+    void HashFillAreaTransforms(uint64_t hashes[NUM_TRANSFORMS]) const;
+    // True if the fill area of other has the same pixels as the fill area of this image transformed by transform
+    bool SameFillArea(const Image &other, int transform = 0) const;
+    // True if the fill area of other has the same pixels as the part of this fill area at x,y in it
+    bool ContainsFillArea(const Image &other, int x, int y) const;
 
     void Blit(const Image &src, int x, int y, int srcx, int srcy, int srcw, int srch);
     void Blit(const Image &src, int x, int y) { Blit(src, x, y, 0, 0, src.w, src.h); }
+    // Like Blit, but leaves the destination where the source pixels are transparent
+    void BlitOpaque(const Image &src, int x, int y, int srcx, int srcy, int srcw, int srch);
 
     unsigned char *at(int x, int y) { return data.get() + (y*w + x)*ncomps; }
     const unsigned char *at(int x, int y) const { return data.get() + (y*w + x)*ncomps; }
@@ -25,11 +25,28 @@
 
 #include "ImagePacker.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <algorithm>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+#include <set>
+#include <mutex>
+#include <random>
+#include <cmath>
 
 #include "Image.h"
 #include "GuillotineBinPack.h"
+#include "MaxRectsBinPack.h"
+#include "SkylineBinPack.h"
+#include "ShelfBinPack.h"
+#include "MaskBinPack.h"
 
 const char *Options::version = "1.0.0";
 
@@ -48,6 +65,29 @@ int NextPower2(int v) {
     return v;
 }
 
+// Final size of the atlas for an occupied extent: the next power of 2, or with -npot
+// the next multiple of the size alignment
+int AtlasSize(const Options &options, int occupied) {
+    if (options.npot) {
+        int align = std::max(1, options.sizeAlign);
+        return (std::max(occupied, 1) + align - 1) / align * align;
+    }
+    return NextPower2(occupied);
+}
+
+// Largest atlas side up to max: a power of 2, or a multiple of the size alignment with -npot
+int LargestAtlasSize(const Options &options, int max) {
+    if (options.npot) {
+        int align = std::max(1, options.sizeAlign);
+        return max / align * align;
+    }
+    int size = 1;
+    while (size*2 <= max) {
+        size *= 2;
+    }
+    return size;
+}
+
 // Another of those functions you wish was standard...
 std::string ReplaceString(std::string subject, const std::string& search,
                           const std::string& replace) {
@@ -95,30 +135,361 @@ void Options::AddInfile(const char *filename) {
 // ------------------
 // Packing
 // ------------------
-void ImagePack(const Options &options)
+
+// Set while a ParallelFor is running, so nested calls run on the calling thread instead of adding more threads
+static std::atomic<bool> parallelBusy(false);
+
+// Run fn(0..count-1) spread over all available cores. Each index is handled by exactly one thread.
+void ParallelFor(int count, const std::function<void(int)> &fn)
 {
-    // Load all images
-    std::vector<Image*> images;
-    for (const auto &i: options.infiles) {
-        Image *img = new Image(i.c_str());
-        if (!img->isLoaded()) {
-            printf("...skipping file %s\n", i.c_str());
-            continue;
+    int numThreads = std::min((int)std::thread::hardware_concurrency(), count);
+    bool expected = false;
+    if (numThreads <= 1 || !parallelBusy.compare_exchange_strong(expected, true)) {
+        for (int i = 0; i < count; ++i) {
+            fn(i);
         }
-        printf("Input file: %s (%d x %d, %d channels).", i.c_str(), img->w, img->h, img->ncomps);
-        img->FindFillArea();
-        printf(" Fill area is %d,%d x %d,%d\n", img->fillx, img->filly, img->fillw, img->fillh);
-        images.push_back(img);
+        return;
+    }
+    std::atomic<int> next(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; ++t) {
+        threads.push_back(std::thread([&]() {
+            for (int i = next++; i < count; i = next++) {
+                fn(i);
+            }
+        }));
+    }
+    for (auto &t: threads) {
+        t.join();
     }
+    parallelBusy = false;
+}
 
-    // Build array of rects corresponding to loaded images
-    std::vector<rbp::RectSize> srcRects;
-    for (auto i : images) {
-        rbp::RectSize r;
-        r.width = i->fillw + options.padx;
-        r.height = i->fillh + options.pady;
-        r.image = i;
-        srcRects.push_back(r);
+enum SortOrder {
+    SORT_NONE,
+    SORT_AREA,
+    SORT_PERIMETER,
+    SORT_MAX_SIDE,
+    SORT_WIDTH,
+    SORT_HEIGHT,
+    NUM_SORT_ORDERS
+};
+
+static const char *algorithmNames[] = { "guillotine", "maxrects", "skyline", "shelf", "mask" };
+static const char *rectChoiceNames[] = { "baf", "bssf", "blsf", "waf", "wssf", "wlsf" };
+static const char *splitMethodNames[] = { "slas", "llas", "minas", "maxas", "sas", "las" };
+static const char *maxRectsChoiceNames[] = { "bssf", "blsf", "baf", "bl", "cp" };
+static const char *skylineChoiceNames[] = { "bl", "minwaste" };
+static const char *shelfChoiceNames[] = { "firstfit", "bestfit" };
+static const char *sortOrderNames[] = { "none", "area", "perimeter", "max-side", "width", "height" };
+
+int FindHeuristic(Options::Algorithm algorithm, const std::string &name)
+{
+    const char **names = nullptr;
+    int count = 0;
+    switch (algorithm) {
+        case Options::ALGORITHM_GUILLOTINE: names = rectChoiceNames; count = 6; break;
+        case Options::ALGORITHM_MAXRECTS: names = maxRectsChoiceNames; count = 5; break;
+        case Options::ALGORITHM_SKYLINE: names = skylineChoiceNames; count = 2; break;
+        case Options::ALGORITHM_SHELF: names = shelfChoiceNames; count = 2; break;
+        case Options::ALGORITHM_MASK: break;
+    }
+    for (int i = 0; i < count; ++i) {
+        if (name.compare(names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Algorithm and heuristic combination used for one packing attempt
+struct PackSettings {
+    Options::Algorithm algorithm;
+    rbp::GuillotineBinPack::FreeRectChoiceHeuristic rectChoice;
+    rbp::GuillotineBinPack::GuillotineSplitHeuristic splitMethod;
+    bool merge;
+    bool specializedLoops;
+    bool groupPlacement;
+    rbp::MaxRectsBinPack::FreeRectChoiceHeuristic maxRectsChoice;
+    rbp::SkylineBinPack::LevelChoiceHeuristic skylineChoice;
+    bool wasteMap;
+    rbp::ShelfBinPack::ShelfChoiceHeuristic shelfChoice;
+    int maskCell;
+    SortOrder sortOrder;
+
+    PackSettings() {
+        algorithm = Options::ALGORITHM_GUILLOTINE;
+        rectChoice = rbp::GuillotineBinPack::RectBestShortSideFit;
+        splitMethod = rbp::GuillotineBinPack::SplitShorterLeftoverAxis;
+        merge = true;
+        specializedLoops = true;
+        groupPlacement = true;
+        maxRectsChoice = rbp::MaxRectsBinPack::RectBestShortSideFit;
+        skylineChoice = rbp::SkylineBinPack::LevelBottomLeft;
+        wasteMap = false;
+        shelfChoice = rbp::ShelfBinPack::ShelfFirstFit;
+        maskCell = 4;
+        sortOrder = SORT_NONE;
+    }
+
+    // Settings selected on the command line
+    explicit PackSettings(const Options &options) {
+        *this = PackSettings();
+        algorithm = options.algorithm;
+        wasteMap = options.wasteMap;
+        if (algorithm == Options::ALGORITHM_SKYLINE) {
+            // Skyline places the rects in the given order, tallest first works best
+            sortOrder = SORT_HEIGHT;
+        }
+        if (algorithm == Options::ALGORITHM_MASK) {
+            // The biggest first leave transparent areas for the small ones
+            sortOrder = SORT_AREA;
+            maskCell = options.maskCell;
+        }
+        if (options.heuristic >= 0) {
+            switch (algorithm) {
+                case Options::ALGORITHM_GUILLOTINE: rectChoice = (rbp::GuillotineBinPack::FreeRectChoiceHeuristic)options.heuristic; break;
+                case Options::ALGORITHM_MAXRECTS: maxRectsChoice = (rbp::MaxRectsBinPack::FreeRectChoiceHeuristic)options.heuristic; break;
+                case Options::ALGORITHM_SKYLINE: skylineChoice = (rbp::SkylineBinPack::LevelChoiceHeuristic)options.heuristic; break;
+                case Options::ALGORITHM_SHELF: shelfChoice = (rbp::ShelfBinPack::ShelfChoiceHeuristic)options.heuristic; break;
+                case Options::ALGORITHM_MASK: break;
+            }
+        }
+    }
+
+    std::string Describe() const {
+        std::string s = algorithmNames[algorithm];
+        switch (algorithm) {
+            case Options::ALGORITHM_GUILLOTINE:
+                s = s + " " + rectChoiceNames[rectChoice] + " " + splitMethodNames[splitMethod] + (merge? " merge" : " no-merge") +
+                    (specializedLoops? "" : " generic") + (groupPlacement? "" : " one-by-one");
+                break;
+            case Options::ALGORITHM_MAXRECTS:
+                s = s + " " + maxRectsChoiceNames[maxRectsChoice];
+                break;
+            case Options::ALGORITHM_SKYLINE:
+                s = s + " " + skylineChoiceNames[skylineChoice] + (wasteMap? " waste-map" : "");
+                break;
+            case Options::ALGORITHM_SHELF:
+                s = s + " " + shelfChoiceNames[shelfChoice];
+                break;
+            case Options::ALGORITHM_MASK:
+                s = s + " cell " + std::to_string(maskCell);
+                break;
+        }
+        return s + " sort " + sortOrderNames[sortOrder];
+    }
+};
+
+// Build a packer configured with the given settings
+std::unique_ptr<rbp::BinPack> CreateBinPack(const PackSettings &settings)
+{
+    switch (settings.algorithm) {
+        case Options::ALGORITHM_MAXRECTS: {
+            rbp::MaxRectsBinPack *packer = new rbp::MaxRectsBinPack();
+            packer->SetHeuristic(settings.maxRectsChoice);
+            return std::unique_ptr<rbp::BinPack>(packer);
+        }
+        case Options::ALGORITHM_SKYLINE: {
+            rbp::SkylineBinPack *packer = new rbp::SkylineBinPack();
+            packer->SetHeuristic(settings.skylineChoice);
+            packer->SetUseWasteMap(settings.wasteMap);
+            return std::unique_ptr<rbp::BinPack>(packer);
+        }
+        case Options::ALGORITHM_SHELF: {
+            rbp::ShelfBinPack *packer = new rbp::ShelfBinPack();
+            packer->SetHeuristic(settings.shelfChoice);
+            return std::unique_ptr<rbp::BinPack>(packer);
+        }
+        case Options::ALGORITHM_MASK: {
+            rbp::MaskBinPack *packer = new rbp::MaskBinPack();
+            packer->SetCellSize(settings.maskCell);
+            return std::unique_ptr<rbp::BinPack>(packer);
+        }
+        case Options::ALGORITHM_GUILLOTINE:
+        default: {
+            rbp::GuillotineBinPack *packer = new rbp::GuillotineBinPack();
+            packer->SetHeuristics(settings.rectChoice, settings.splitMethod, settings.merge);
+            packer->SetSpecializedLoops(settings.specializedLoops);
+            packer->SetGroupPlacement(settings.groupPlacement);
+            return std::unique_ptr<rbp::BinPack>(packer);
+        }
+    }
+}
+
+struct PackResult {
+    int w;
+    int h;
+    float fill;     // Ratio of used area to the occupied bounding box
+    std::vector<rbp::Rect> usedRects;
+};
+
+// Bigger rects first; stable so equal keys keep the input order
+void SortRects(std::vector<rbp::RectSize> &rects, SortOrder order)
+{
+    std::function<int(const rbp::RectSize &)> key;
+    switch (order) {
+        case SORT_NONE: return;
+        case SORT_AREA: key = [](const rbp::RectSize &r) { return r.width*r.height; }; break;
+        case SORT_PERIMETER: key = [](const rbp::RectSize &r) { return r.width+r.height; }; break;
+        case SORT_MAX_SIDE: key = [](const rbp::RectSize &r) { return std::max(r.width, r.height); }; break;
+        case SORT_WIDTH: key = [](const rbp::RectSize &r) { return r.width; }; break;
+        case SORT_HEIGHT: key = [](const rbp::RectSize &r) { return r.height; }; break;
+        default: return;
+    }
+    std::stable_sort(rects.begin(), rects.end(), [&](const rbp::RectSize &a, const rbp::RectSize &b) { return key(a) > key(b); });
+}
+
+// Ratio of the packed area to the occupied bounding box
+float Fill(rbp::BinPack &binPacker)
+{
+    long long usedArea = 0;
+    for (const auto &r: binPacker.GetUsedRectangles()) {
+        usedArea += (long long)r.width*r.height;
+    }
+    return (float)usedArea / ((long long)binPacker.GetOccupiedWidth()*binPacker.GetOccupiedHeight());
+}
+
+// Area a rect takes in any bin. Packed by their masks, rects only take the cells with content, and of those only
+// the whole cells inside the rect are sure to be inside the bin.
+long long PackedArea(const rbp::RectSize &r)
+{
+    const Image *image = r.image;
+    if (image == nullptr || image->cellMask.empty()) {
+        return (long long)r.width*r.height;
+    }
+    int cols = std::min(r.width / image->cellSize, image->cellCols);
+    int rows = std::min(r.height / image->cellSize, image->cellRows);
+    long long cells = 0;
+    for (int y = 0; y < rows; ++y) {
+        for (int x = 0; x < cols; ++x) {
+            cells += image->cellMask[y*image->cellCols + x];
+        }
+    }
+    return cells*image->cellSize*image->cellSize;
+}
+
+// Lower bounds that any bin holding all the rects must meet, to skip bin sizes that cannot work without packing
+struct PackBounds {
+    long long area;
+    int widest;
+    int tallest;
+    int longest;
+
+    PackBounds(const std::vector<rbp::RectSize> &rects, bool flip) {
+        area = 0;
+        widest = tallest = longest = 0;
+        for (const auto &r: rects) {
+            area += PackedArea(r);
+            if (flip) {
+                // A rotated rect needs its short side in the short side of the bin
+                widest = tallest = std::max(widest, std::min(r.width, r.height));
+                longest = std::max(longest, std::max(r.width, r.height));
+            } else {
+                widest = std::max(widest, r.width);
+                tallest = std::max(tallest, r.height);
+            }
+        }
+    }
+
+    bool MayFit(int binWidth, int binHeight) const {
+        return widest <= binWidth && tallest <= binHeight && longest <= std::max(binWidth, binHeight) &&
+            area <= (long long)binWidth*binHeight;
+    }
+};
+
+// Search the smallest non power of 2 atlas. Each candidate width gets the whole maximum height, and the
+// height actually used gives the atlas size. Evenly spaced widths are tried first, then the search narrows
+// around the best one until the steps reach the size alignment.
+bool PackRectsNpot(const Options &options, const std::vector<rbp::RectSize> &rects, const PackSettings &settings, PackResult &result)
+{
+    int align = std::max(1, options.sizeAlign);
+    PackBounds bounds(rects, options.allowFlipping);
+    long long areaWidth = (bounds.area + options.maxh + options.pady - 1) / (options.maxh + options.pady);
+    int lo = AtlasSize(options, std::max((int)std::min(areaWidth, (long long)options.maxw + 1), bounds.widest) - options.padx);
+    lo = std::max(lo, AtlasSize(options, options.minw));
+    int hi = options.maxw / align * align;
+    if (lo > hi) {
+        result.w = lo;
+        result.h = options.maxh;
+        result.usedRects.clear();
+        result.fill = 0.0f;
+        return false;
+    }
+
+    bool found = false;
+    long long bestArea = 0;
+    while (true) {
+        int step = std::max(align, ((hi - lo) / 31 + align - 1) / align * align);
+        std::vector<int> widths;
+        for (int w = lo; w <= hi; w += step) {
+            widths.push_back(w);
+        }
+        std::vector<PackResult> results(widths.size());
+        std::vector<char> valid(widths.size());
+        ParallelFor((int)widths.size(), [&](int i) {
+            if (!bounds.MayFit(widths[i]+options.padx, options.maxh+options.pady)) {
+                valid[i] = false;
+                return;
+            }
+            std::unique_ptr<rbp::BinPack> packer = CreateBinPack(settings);
+            std::vector<rbp::RectSize> left = rects;
+            packer->Init(widths[i]+options.padx, options.maxh+options.pady);
+            if (!packer->Insert(left, options.allowFlipping)) {
+                valid[i] = false;
+                return;
+            }
+            PackResult &r = results[i];
+            r.w = AtlasSize(options, std::max(packer->GetOccupiedWidth()-options.padx, options.minw));
+            r.h = AtlasSize(options, std::max(packer->GetOccupiedHeight()-options.pady, options.minh));
+            if (options.forceSquare) {
+                r.w = r.h = std::max(r.w, r.h);
+            }
+            r.usedRects = packer->GetUsedRectangles();
+            r.fill = Fill(*packer);
+            valid[i] = r.w <= options.maxw && r.h <= options.maxh;
+        });
+        int bestIndex = -1;
+        for (int i = 0; i < (int)widths.size(); ++i) {
+            if (!valid[i]) {
+                continue;
+            }
+            long long area = (long long)results[i].w*results[i].h;
+            if (!found || area < bestArea || (area == bestArea && std::max(results[i].w, results[i].h) < std::max(result.w, result.h))) {
+                found = true;
+                bestArea = area;
+                bestIndex = i;
+                result = std::move(results[i]);
+            }
+        }
+        if (step == align) {
+            break;
+        }
+        // Narrow down around the best width of this pass
+        int center = bestIndex >= 0? widths[bestIndex] : (found? result.w : hi);
+        lo = std::max(lo, center - step + align);
+        hi = std::min(hi, center + step - align);
+        if (lo > hi) {
+            break;
+        }
+    }
+    if (!found) {
+        result.w = options.maxw;
+        result.h = options.maxh;
+        result.usedRects.clear();
+        result.fill = 0.0f;
+    }
+    return found;
+}
+
+// Pack all rects with the given settings, growing from the minimum size until they fit.
+// Returns false if the result exceeds the maximum size.
+bool PackRects(const Options &options, const std::vector<rbp::RectSize> &srcRects, const PackSettings &settings, PackResult &result)
+{
+    std::vector<rbp::RectSize> rects = srcRects;
+    SortRects(rects, settings.sortOrder);
+    if (options.npot) {
+        return PackRectsNpot(options, rects, settings, result);
     }
 
     // Iterate from min size until all images fit
@@ -128,16 +499,7 @@ void ImagePack(const Options &options)
     if (options.forceSquare) {
         w = h = std::max(w, h);
     }
-    rbp::GuillotineBinPack binPacker;
-    while (true) {
-        // Add margin to destination because all source images are given a margin,
-        // but those ending up on the right or bottom don't need it
-        binPacker.Init(w+options.padx, h+options.pady);
-        bool allFit = binPacker.Insert(srcRects, true, options.allowFlipping, rbp::GuillotineBinPack::RectBestShortSideFit, rbp::GuillotineBinPack::SplitShorterLeftoverAxis);
-        if (allFit) {
-            break;
-        }
-        // Impossible to fit them all, grow the rectangle
+    auto grow = [&]() {
         if (options.forceSquare) {
             w *= 2;
             h = w;
@@ -146,18 +508,1467 @@ void ImagePack(const Options &options)
         } else {
             w *= 2;
         }
+    };
+    // Add margin to destination because all source images are given a margin,
+    // but those ending up on the right or bottom don't need it.
+    // Sizes too small for the total area or the biggest rect are skipped without packing.
+    PackBounds bounds(rects, options.allowFlipping);
+    while (!bounds.MayFit(w+options.padx, h+options.pady)) {
+        grow();
+    }
+    std::unique_ptr<rbp::BinPack> packer = CreateBinPack(settings);
+    std::vector<rbp::RectSize> left = rects;
+    packer->Init(w+options.padx, h+options.pady);
+    int prevw = 0;
+    int prevh = 0;
+    bool placed = true;
+    while (!packer->Insert(left, options.allowFlipping)) {
+        // Past the maximum on both sides the result is too big anyway, and rects the packer cannot place at all
+        // would grow the bin forever
+        if (w > options.maxw && h > options.maxh) {
+            placed = false;
+            break;
+        }
+        prevw = w;
+        prevh = h;
+        // Impossible to fit them all, grow the rectangle
+        do {
+            grow();
+        } while (!bounds.MayFit(w+options.padx, h+options.pady));
+        if (options.fullRepack) {
+            left = rects;
+            packer->Init(w+options.padx, h+options.pady);
+        } else {
+            // Keep what is placed and continue with the rects left in the bigger bin
+            packer->Grow(w+options.padx, h+options.pady);
+        }
+    }
+    if (placed && !options.fullRepack && prevw > 0) {
+        // The rects placed before growing can spoil the layout, packing from scratch at the previous
+        // size sometimes fits where growing did not
+        std::unique_ptr<rbp::BinPack> retry = CreateBinPack(settings);
+        left = rects;
+        retry->Init(prevw+options.padx, prevh+options.pady);
+        auto atlasArea = [&](const rbp::BinPack &p) {
+            return (long long)AtlasSize(options, p.GetOccupiedWidth()-options.padx)*AtlasSize(options, p.GetOccupiedHeight()-options.pady);
+        };
+        if (retry->Insert(left, options.allowFlipping) && atlasArea(*retry) <= atlasArea(*packer)) {
+            packer.swap(retry);
+        }
     }
     // Recompute actually occupied area
-    w = NextPower2(binPacker.GetOccupiedWidth()-options.padx);
-    h = NextPower2(binPacker.GetOccupiedHeight()-options.pady);
-    if (w > options.maxw || h > options.maxh) {
-        fprintf(stderr, "Error: impossible to fit all images. Best case is %d x %d\n", w, h);
-        exit(1);
+    result.w = AtlasSize(options, packer->GetOccupiedWidth()-options.padx);
+    result.h = AtlasSize(options, packer->GetOccupiedHeight()-options.pady);
+    result.usedRects = packer->GetUsedRectangles();
+    result.fill = Fill(*packer);
+    return placed && result.w <= options.maxw && result.h <= options.maxh;
+}
+
+// Pack with every algorithm, heuristic combination and sort order in parallel, keep the smallest atlas.
+// Ties are broken by the tightest occupied bounding box, then by the order of the combinations.
+bool PackBest(const Options &options, const std::vector<rbp::RectSize> &srcRects, PackResult &best)
+{
+    std::vector<PackSettings> combos;
+    for (int sort = 0; sort < NUM_SORT_ORDERS; ++sort) {
+        for (int choice = rbp::GuillotineBinPack::RectBestAreaFit; choice <= rbp::GuillotineBinPack::RectWorstLongSideFit; ++choice) {
+            for (int split = rbp::GuillotineBinPack::SplitShorterLeftoverAxis; split <= rbp::GuillotineBinPack::SplitLongerAxis; ++split) {
+                for (int merge = 1; merge >= 0; --merge) {
+                    PackSettings s;
+                    s.rectChoice = (rbp::GuillotineBinPack::FreeRectChoiceHeuristic)choice;
+                    s.splitMethod = (rbp::GuillotineBinPack::GuillotineSplitHeuristic)split;
+                    s.merge = merge != 0;
+                    s.sortOrder = (SortOrder)sort;
+                    combos.push_back(s);
+                }
+            }
+        }
+        for (int choice = rbp::MaxRectsBinPack::RectBestShortSideFit; choice <= rbp::MaxRectsBinPack::RectContactPointRule; ++choice) {
+            PackSettings s;
+            s.algorithm = Options::ALGORITHM_MAXRECTS;
+            s.maxRectsChoice = (rbp::MaxRectsBinPack::FreeRectChoiceHeuristic)choice;
+            s.sortOrder = (SortOrder)sort;
+            combos.push_back(s);
+        }
+        for (int choice = rbp::SkylineBinPack::LevelBottomLeft; choice <= rbp::SkylineBinPack::LevelMinWasteFit; ++choice) {
+            for (int wasteMap = 1; wasteMap >= 0; --wasteMap) {
+                PackSettings s;
+                s.algorithm = Options::ALGORITHM_SKYLINE;
+                s.skylineChoice = (rbp::SkylineBinPack::LevelChoiceHeuristic)choice;
+                s.wasteMap = wasteMap != 0;
+                s.sortOrder = (SortOrder)sort;
+                combos.push_back(s);
+            }
+        }
+    }
+    // The shelf packer sorts by height itself, so the input order matters little
+    for (int choice = rbp::ShelfBinPack::ShelfFirstFit; choice <= rbp::ShelfBinPack::ShelfBestFit; ++choice) {
+        PackSettings s;
+        s.algorithm = Options::ALGORITHM_SHELF;
+        s.shelfChoice = (rbp::ShelfBinPack::ShelfChoiceHeuristic)choice;
+        combos.push_back(s);
+    }
+
+    std::vector<PackResult> results(combos.size());
+    std::vector<char> valid(combos.size());
+    ParallelFor((int)combos.size(), [&](int i) {
+        valid[i] = PackRects(options, srcRects, combos[i], results[i]);
+    });
+
+    int bestIndex = -1;
+    for (int i = 0; i < (int)combos.size(); ++i) {
+        if (!valid[i]) {
+            continue;
+        }
+        if (bestIndex < 0) {
+            bestIndex = i;
+            continue;
+        }
+        const PackResult &r = results[i];
+        const PackResult &b = results[bestIndex];
+        long long area = (long long)r.w*r.h;
+        long long bestArea = (long long)b.w*b.h;
+        if (area < bestArea || (area == bestArea && r.fill > b.fill)) {
+            bestIndex = i;
+        }
+    }
+    if (bestIndex < 0) {
+        // Nothing fits, report the default attempt
+        return PackRects(options, srcRects, PackSettings(options), best);
+    }
+    printf("Best of %d combinations: %s (%d x %d, %.1f%% fill)\n", (int)combos.size(),
+        combos[bestIndex].Describe().c_str(), results[bestIndex].w, results[bestIndex].h, results[bestIndex].fill*100.0f);
+    best = std::move(results[bestIndex]);
+    return true;
+}
+
+// ------------------
+// Uniform grids
+// ------------------
+
+// Groups with at least this many rects of the same size are laid out as a grid
+const int MIN_GRID_GROUP = 16;
+
+// A group of same size rects packed as a single block, cells in row order
+struct GridBlock {
+    std::vector<Image*> images;
+    int cols;
+    int rows;
+    int cellw;
+    int cellh;
+};
+
+// Lay out rects that all have the same size on a grid, in O(n). Picks the grid shape with the
+// smallest atlas, and the most square one among those.
+bool PackUniformGrid(const Options &options, const std::vector<rbp::RectSize> &rects, PackResult &result)
+{
+    int n = (int)rects.size();
+    long long bestArea = 0;
+    int bestSide = 0;
+    int bestCols = 0;
+    bool bestFlip = false;
+    for (int flip = 0; flip <= (options.allowFlipping? 1 : 0); ++flip) {
+        int cellw = flip? rects[0].height : rects[0].width;
+        int cellh = flip? rects[0].width : rects[0].height;
+        for (int cols = 1; cols <= n; ++cols) {
+            int rows = (n + cols - 1) / cols;
+            int w = std::max(AtlasSize(options, cols*cellw - options.padx), AtlasSize(options, options.minw));
+            int h = std::max(AtlasSize(options, rows*cellh - options.pady), AtlasSize(options, options.minh));
+            if (options.forceSquare) {
+                w = h = std::max(w, h);
+            }
+            if (w > options.maxw || h > options.maxh) {
+                continue;
+            }
+            long long area = (long long)w*h;
+            if (bestCols == 0 || area < bestArea || (area == bestArea && std::max(w, h) < bestSide)) {
+                bestArea = area;
+                bestSide = std::max(w, h);
+                bestCols = cols;
+                bestFlip = flip != 0;
+            }
+        }
+    }
+    if (bestCols == 0) {
+        return false;
+    }
+
+    int cellw = bestFlip? rects[0].height : rects[0].width;
+    int cellh = bestFlip? rects[0].width : rects[0].height;
+    int rows = (n + bestCols - 1) / bestCols;
+    result.usedRects.clear();
+    for (int i = 0; i < n; ++i) {
+        rbp::Rect r;
+        r.x = (i % bestCols)*cellw;
+        r.y = (i / bestCols)*cellh;
+        r.width = cellw;
+        r.height = cellh;
+        r.image = rects[i].image;
+        r.flipped = bestFlip;
+        result.usedRects.push_back(r);
+    }
+    int occw = std::min(n, bestCols)*cellw;
+    int occh = rows*cellh;
+    result.w = std::max(AtlasSize(options, occw - options.padx), AtlasSize(options, options.minw));
+    result.h = std::max(AtlasSize(options, occh - options.pady), AtlasSize(options, options.minh));
+    if (options.forceSquare) {
+        result.w = result.h = std::max(result.w, result.h);
+    }
+    result.fill = (float)((long long)n*cellw*cellh) / ((long long)occw*occh);
+    printf("All images have the same size, packed as a %d x %d grid\n", bestCols, rows);
+    return true;
+}
+
+// Replace each large group of same size rects with a single block rect. Blocks only take full rows, so the
+// few rects left over are packed as usual. Returns the rects to pack.
+std::vector<rbp::RectSize> BuildGridBlocks(const Options &options, const std::vector<rbp::RectSize> &srcRects, std::vector<GridBlock> &blocks)
+{
+    std::map<std::pair<int, int>, std::vector<int> > groups;
+    for (int i = 0; i < (int)srcRects.size(); ++i) {
+        groups[std::make_pair(srcRects[i].width, srcRects[i].height)].push_back(i);
+    }
+
+    // Index of the block each rect was put in, -1 if none
+    std::vector<int> blockOf(srcRects.size(), -1);
+    for (const auto &g: groups) {
+        const std::vector<int> &members = g.second;
+        int n = (int)members.size();
+        if (n < MIN_GRID_GROUP) {
+            continue;
+        }
+        int cellw = g.first.first;
+        int cellh = g.first.second;
+        // Pick the shape that leaves fewest rects out, preferring blocks no more than twice as long as wide
+        int bestCols = 0;
+        int bestLeft = 0;
+        float bestAspect = 0.0f;
+        for (int cols = 1; cols <= n; ++cols) {
+            int rows = n / cols;
+            int bw = cols*cellw;
+            int bh = rows*cellh;
+            if (bw > options.maxw + options.padx || bh > options.maxh + options.pady) {
+                continue;
+            }
+            int left = n - rows*cols;
+            float aspect = (float)std::max(bw, bh) / std::min(bw, bh);
+            bool better;
+            if (bestCols == 0) {
+                better = true;
+            } else if ((aspect <= 2.0f) != (bestAspect <= 2.0f)) {
+                better = aspect <= 2.0f;
+            } else if (aspect > 2.0f) {
+                better = aspect < bestAspect;
+            } else {
+                better = left < bestLeft || (left == bestLeft && aspect < bestAspect);
+            }
+            if (better) {
+                bestCols = cols;
+                bestLeft = left;
+                bestAspect = aspect;
+            }
+        }
+        if (bestCols == 0 || n - bestLeft < 2) {
+            continue;
+        }
+        GridBlock block;
+        block.cols = bestCols;
+        block.rows = n / bestCols;
+        block.cellw = cellw;
+        block.cellh = cellh;
+        for (int i = 0; i < block.cols*block.rows; ++i) {
+            block.images.push_back(srcRects[members[i]].image);
+            blockOf[members[i]] = (int)blocks.size();
+        }
+        blocks.push_back(block);
+    }
+
+    // Keep the input order, with each block where its first rect was
+    std::vector<rbp::RectSize> rects;
+    for (int i = 0; i < (int)srcRects.size(); ++i) {
+        int b = blockOf[i];
+        if (b < 0) {
+            rects.push_back(srcRects[i]);
+        } else if (blocks[b].images[0] == srcRects[i].image) {
+            rbp::RectSize r;
+            r.width = blocks[b].cols*blocks[b].cellw;
+            r.height = blocks[b].rows*blocks[b].cellh;
+            r.image = blocks[b].images[0];
+            rects.push_back(r);
+        }
+    }
+    return rects;
+}
+
+// Replace the packed block rects with the rects of their cells
+void ExpandGridBlocks(const std::vector<GridBlock> &blocks, std::vector<rbp::Rect> &usedRects)
+{
+    std::map<Image*, const GridBlock *> blockByImage;
+    for (const auto &b: blocks) {
+        blockByImage[b.images[0]] = &b;
+    }
+    std::vector<rbp::Rect> expanded;
+    for (const auto &r: usedRects) {
+        auto it = blockByImage.find(r.image);
+        if (it == blockByImage.end()) {
+            expanded.push_back(r);
+            continue;
+        }
+        // A rotated block is a grid of rotated cells, rows and columns swapped
+        const GridBlock &b = *it->second;
+        int cols = r.flipped? b.rows : b.cols;
+        int cellw = r.flipped? b.cellh : b.cellw;
+        int cellh = r.flipped? b.cellw : b.cellh;
+        for (int i = 0; i < (int)b.images.size(); ++i) {
+            rbp::Rect cell;
+            cell.x = r.x + (i % cols)*cellw;
+            cell.y = r.y + (i / cols)*cellh;
+            cell.width = cellw;
+            cell.height = cellh;
+            cell.image = b.images[i];
+            cell.flipped = r.flipped;
+            expanded.push_back(cell);
+        }
+    }
+    usedRects.swap(expanded);
+}
+
+// Time each packer on the same input to compare their speed and the resulting atlas
+void RunBenchmark(const Options &options, const std::vector<rbp::RectSize> &srcRects)
+{
+    std::vector<PackSettings> configs;
+    PackSettings s;
+    configs.push_back(s);
+    // The Guillotine loop compiled for its heuristics against the generic one
+    s.specializedLoops = false;
+    configs.push_back(s);
+    s.specializedLoops = true;
+    // Rects of the same size placed in grids against one at a time
+    s.groupPlacement = false;
+    configs.push_back(s);
+    s.groupPlacement = true;
+    s.algorithm = Options::ALGORITHM_MAXRECTS;
+    configs.push_back(s);
+    s.algorithm = Options::ALGORITHM_SKYLINE;
+    s.sortOrder = SORT_HEIGHT;
+    configs.push_back(s);
+    s.wasteMap = true;
+    configs.push_back(s);
+    s.skylineChoice = rbp::SkylineBinPack::LevelMinWasteFit;
+    configs.push_back(s);
+    s = PackSettings();
+    s.algorithm = Options::ALGORITHM_SHELF;
+    configs.push_back(s);
+    s.shelfChoice = rbp::ShelfBinPack::ShelfBestFit;
+    configs.push_back(s);
+
+    PackResult reference;
+    printf("Benchmark of %d rects\n", (int)srcRects.size());
+    printf("  %-46s %-7s %10s %12s %7s\n", "Packer", "Growth", "ms/pack", "Size", "Fill");
+    for (const auto &config: configs) {
+        // Growing the bin and repacking from scratch are compared on each packer
+        for (int repack = 0; repack <= 1; ++repack) {
+            Options runOptions = options;
+            runOptions.fullRepack = repack != 0;
+            // Repeat for at least a fraction of a second to get a stable average
+            PackResult result;
+            bool fits = false;
+            int runs = 0;
+            auto start = std::chrono::steady_clock::now();
+            double elapsed = 0.0;
+            do {
+                fits = PackRects(runOptions, srcRects, config, result);
+                ++runs;
+                elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            } while (elapsed < 0.25 && runs < 1000);
+            if (&config == &configs[0] && !repack) {
+                reference = result;
+            }
+            char size[32];
+            snprintf(size, sizeof(size), "%d x %d%s", result.w, result.h, fits? "" : "!");
+            printf("  %-46s %-7s %10.3f %12s %6.1f%%\n", repack? "" : config.Describe().c_str(), repack? "repack" : "grow",
+                elapsed*1000.0/runs, size, result.fill*100.0f);
+        }
+    }
+
+    // Online insertion one rect at a time into the atlas of the default packer, as a runtime cache would do it
+    rbp::GuillotineBinPack online;
+    size_t placed = 0;
+    int runs = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do {
+        online.Init(reference.w+options.padx, reference.h+options.pady);
+        placed = 0;
+        for (const auto &r: srcRects) {
+            if (online.TryInsert(r.width, r.height, options.allowFlipping).height != 0) {
+                ++placed;
+            }
+        }
+        ++runs;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 0.25 && runs < 1000);
+    char size[32];
+    snprintf(size, sizeof(size), "%d x %d%s", reference.w, reference.h, placed == srcRects.size()? "" : "!");
+    printf("  %-46s %-7s %10.3f %12s %6.1f%%\n", "guillotine online TryInsert", "", elapsed*1000.0/runs, size,
+        Fill(online)*100.0f);
+
+    // Churn of a runtime cache: every other rect is evicted, the free space is defragmented for a few
+    // frames, and the evicted rects are inserted again
+    std::vector<int> ids(srcRects.size());
+    std::vector<rbp::GuillotineBinPack::RectMove> moves;
+    runs = 0;
+    start = std::chrono::steady_clock::now();
+    do {
+        online.Init(reference.w+options.padx, reference.h+options.pady);
+        for (size_t i = 0; i < srcRects.size(); ++i) {
+            if (online.TryInsert(srcRects[i].width, srcRects[i].height, options.allowFlipping, &ids[i]).height == 0) {
+                ids[i] = -1;
+            }
+        }
+        for (size_t i = 1; i < srcRects.size(); i += 2) {
+            if (ids[i] >= 0) {
+                online.Remove(ids[i]);
+            }
+        }
+        moves.clear();
+        for (int frame = 0; frame < 8; ++frame) {
+            online.Defragment(16, moves);
+        }
+        placed = 0;
+        for (size_t i = 0; i < srcRects.size(); ++i) {
+            if (i % 2 == 0) {
+                placed += ids[i] >= 0? 1 : 0;
+            } else if (online.TryInsert(srcRects[i].width, srcRects[i].height, options.allowFlipping).height != 0) {
+                ++placed;
+            }
+        }
+        ++runs;
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < 0.25 && runs < 1000);
+    snprintf(size, sizeof(size), "%d x %d%s", reference.w, reference.h, placed == srcRects.size()? "" : "!");
+    char name[64];
+    snprintf(name, sizeof(name), "guillotine online churn, %d moves", (int)moves.size());
+    printf("  %-46s %-7s %10.3f %12s %6.1f%%\n", name, "", elapsed*1000.0/runs, size, Fill(online)*100.0f);
+}
+
+// Smallest atlas allowed by the lower bounds, with the same size rounding as the packing. False if even
+// the maximum size is too small.
+bool SmallestPossibleAtlas(const Options &options, const PackBounds &bounds, int &bestw, int &besth)
+{
+    bool found = false;
+    for (int w = AtlasSize(options, 1); w <= options.maxw; w = options.npot? w + std::max(1, options.sizeAlign) : w*2) {
+        // Height needed at this width by the total area and the tallest rect
+        long long areaHeight = (bounds.area + w + options.padx - 1) / (w + options.padx) - options.pady;
+        int h = AtlasSize(options, std::max((int)std::min(areaHeight, (long long)options.maxh + 1), bounds.tallest - options.pady));
+        int cw = w;
+        if (options.forceSquare) {
+            cw = h = std::max(w, h);
+        }
+        if (cw > options.maxw || h > options.maxh || !bounds.MayFit(cw+options.padx, h+options.pady)) {
+            continue;
+        }
+        long long area = (long long)cw*h;
+        long long bestArea = (long long)bestw*besth;
+        if (!found || area < bestArea || (area == bestArea && std::max(cw, h) < std::max(bestw, besth))) {
+            found = true;
+            bestw = cw;
+            besth = h;
+        }
+    }
+    return found;
+}
+
+// Tell how far the atlas is from the best possible one, to know if more packing effort is worth it
+void ReportOptimalityGap(const Options &options, const std::vector<rbp::RectSize> &srcRects, const std::vector<PackResult> &pages)
+{
+    PackBounds bounds(srcRects, options.allowFlipping);
+    long long imageArea = 0;
+    for (const auto &r: srcRects) {
+        imageArea += (long long)r.image->fillw*r.image->fillh;
+    }
+    long long atlasArea = 0;
+    for (const auto &page: pages) {
+        atlasArea += (long long)page.w*page.h;
+    }
+    // Images packed by their masks overlap, only the cells with content are meaningful
+    if (options.algorithm == Options::ALGORITHM_MASK) {
+        printf("Image masks cover %.1f%% of the atlas area\n", 100.0*bounds.area/atlasArea);
+    } else {
+        printf("Images cover %.1f%% of the atlas area\n", 100.0*imageArea/atlasArea);
+    }
+    int w = 0;
+    int h = 0;
+    if (pages.size() == 1 && SmallestPossibleAtlas(options, bounds, w, h)) {
+        // Without power of 2 sizes many shapes have about the same area, only the area is meaningful
+        if (options.npot) {
+            printf("Lower bound is %lld pixels, the atlas is %.2fx that area\n", (long long)w*h, (double)atlasArea/((long long)w*h));
+        } else {
+            printf("Lower bound is %d x %d, the atlas is %.2fx that area\n", w, h, (double)atlasArea/((long long)w*h));
+        }
+    } else {
+        long long pageArea = (long long)(LargestAtlasSize(options, options.maxw)+options.padx)*(LargestAtlasSize(options, options.maxh)+options.pady);
+        printf("Lower bound is %d pages, the atlas has %d\n", (int)((bounds.area + pageArea - 1) / pageArea), (int)pages.size());
+    }
+}
+
+// ------------------
+// Order search
+// ------------------
+
+// Next smaller atlas size to search a layout for, shrinking the longer side first. Without power of 2 sizes,
+// sides shrink by 1% or else by the size alignment. False if the bounds rule out anything smaller.
+bool NextSearchTarget(const Options &options, const PackBounds &bounds, int w, int h, int &tw, int &th)
+{
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        auto shrink = [&](int side) {
+            if (!options.npot) {
+                return side / 2;
+            }
+            int step = (attempt < 2)? side / 100 / options.sizeAlign * options.sizeAlign : 0;
+            return side - std::max(options.sizeAlign, step);
+        };
+        bool shrinkWidth = (w > h) == (attempt % 2 == 0);
+        tw = shrinkWidth? shrink(w) : w;
+        th = shrinkWidth? h : shrink(h);
+        if (options.forceSquare) {
+            tw = th = std::min(tw, th);
+        }
+        if (tw > 0 && th > 0 && bounds.MayFit(tw+options.padx, th+options.pady)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Insert the rects one at a time in the given order, rotated where asked. Returns the area left out.
+long long PlaceInOrder(rbp::BinPack &packer, int w, int h, const std::vector<rbp::RectSize> &order, const std::vector<char> &rotated)
+{
+    packer.Init(w, h);
+    long long areaLeft = 0;
+    for (size_t i = 0; i < order.size(); ++i) {
+        rbp::RectSize r = order[i];
+        if (rotated[i]) {
+            std::swap(r.width, r.height);
+        }
+        if (packer.Insert(r, false).height == 0) {
+            areaLeft += (long long)r.width*r.height;
+        }
+    }
+    return areaLeft;
+}
+
+// Orders each searcher tries between the points where the searchers compare their results
+static const int SEARCH_STEP_EVALUATIONS = 256;
+
+// Orders over which the temperature of a searcher falls, after which it heats up again
+static const int SEARCH_COOLING_EVALUATIONS = 16384;
+
+// The state of one of the annealing searches of the order search
+struct OrderSearcher {
+    std::mt19937 rng;
+    std::unique_ptr<rbp::BinPack> packer;
+    std::vector<rbp::RectSize> order;
+    std::vector<char> rotated;
+    long long cost;
+    long long evaluations;  // Since the start of the round
+};
+
+// Search for a smaller atlas than the packed one, within the time budget and the evaluation budget of each
+// searcher, where not 0. There is a searcher per core, and each anneals the insertion order and rotations of the
+// rects, minimizing the area that does not fit in a target size a step smaller. The searchers run in steps of
+// the same number of evaluations, and after each step the first one that fits the target wins: all continue
+// from its order with the next smaller target. Each searcher has its own random generator from the seed, and
+// its temperature only depends on the orders it tried, so with the same seed and number of cores the search
+// repeats exactly. The time budget is only checked between steps, it decides how far the search gets.
+void OptimizeLayout(const Options &options, int budgetMs, int budgetEvaluations, PackResult &result)
+{
+    std::vector<rbp::RectSize> startOrder;
+    std::vector<char> startRotated;
+    for (const auto &r: result.usedRects) {
+        rbp::RectSize s = { r.flipped? r.height : r.width, r.flipped? r.width : r.height, r.image };
+        startOrder.push_back(s);
+        startRotated.push_back(r.flipped);
+    }
+    PackBounds bounds(startOrder, options.allowFlipping);
+    int targetw = 0;
+    int targeth = 0;
+    if (startOrder.size() < 2 || !NextSearchTarget(options, bounds, result.w, result.h, targetw, targeth)) {
+        printf("Order search skipped, the area of the images allows nothing smaller than %d x %d\n", result.w, result.h);
+        return;
+    }
+
+    PackSettings settings(options);
+    int startw = result.w;
+    int starth = result.h;
+    double meanArea = (double)bounds.area / startOrder.size();
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budgetMs);
+
+    int numSearchers = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<OrderSearcher> searchers(numSearchers);
+    for (int t = 0; t < numSearchers; ++t) {
+        searchers[t].rng.seed(options.seed + t);
+        searchers[t].packer = CreateBinPack(settings);
+    }
+    long long evaluations = 0;
+    bool newRound = true;
+    bool done = false;
+    while (!done && (budgetMs <= 0 || std::chrono::steady_clock::now() < deadline) &&
+           (budgetEvaluations <= 0 || evaluations < budgetEvaluations)) {
+        int w = targetw + options.padx;
+        int h = targeth + options.pady;
+        int stepEvaluations = SEARCH_STEP_EVALUATIONS;
+        if (budgetEvaluations > 0) {
+            stepEvaluations = (int)std::min((long long)stepEvaluations, budgetEvaluations - evaluations);
+        }
+        ParallelFor(numSearchers, [&](int t) {
+            OrderSearcher &s = searchers[t];
+            if (newRound) {
+                // New target, restart from the best order so far. Other searchers start from their own sort
+                // order or a shuffle of it, for a multi-start search.
+                s.order = startOrder;
+                s.rotated = startRotated;
+                if (t % 2 == 1) {
+                    SortRects(s.order, (SortOrder)(1 + t/2 % (NUM_SORT_ORDERS - 1)));
+                    std::fill(s.rotated.begin(), s.rotated.end(), 0);
+                } else if (t > 0) {
+                    std::shuffle(s.order.begin(), s.order.end(), s.rng);
+                    std::fill(s.rotated.begin(), s.rotated.end(), 0);
+                }
+                s.cost = PlaceInOrder(*s.packer, w, h, s.order, s.rotated);
+                s.evaluations = 0;
+            }
+            for (int e = 0; e < stepEvaluations && s.cost > 0; ++e) {
+                // Swap two rects, move one to another place, or rotate one
+                int n = (int)s.order.size();
+                int i = std::uniform_int_distribution<int>(0, n - 1)(s.rng);
+                int j = std::uniform_int_distribution<int>(0, n - 1)(s.rng);
+                int kind = std::uniform_int_distribution<int>(0, options.allowFlipping? 2 : 1)(s.rng);
+                auto moveRect = [&](int from, int to) {
+                    if (from < to) {
+                        std::rotate(s.order.begin() + from, s.order.begin() + from + 1, s.order.begin() + to + 1);
+                        std::rotate(s.rotated.begin() + from, s.rotated.begin() + from + 1, s.rotated.begin() + to + 1);
+                    } else {
+                        std::rotate(s.order.begin() + to, s.order.begin() + from, s.order.begin() + from + 1);
+                        std::rotate(s.rotated.begin() + to, s.rotated.begin() + from, s.rotated.begin() + from + 1);
+                    }
+                };
+                switch (kind) {
+                    case 0: std::swap(s.order[i], s.order[j]); std::swap(s.rotated[i], s.rotated[j]); break;
+                    case 1: moveRect(i, j); break;
+                    case 2: s.rotated[i] = !s.rotated[i]; break;
+                }
+                long long newCost = PlaceInOrder(*s.packer, w, h, s.order, s.rotated);
+                // Accept worse orders less often as the temperature falls over the cooling period
+                double progress = (double)(s.evaluations++ % SEARCH_COOLING_EVALUATIONS) / SEARCH_COOLING_EVALUATIONS;
+                double temperature = 0.25 * meanArea * std::pow(0.001, progress);
+                if (newCost <= s.cost || std::uniform_real_distribution<double>(0.0, 1.0)(s.rng) < std::exp((s.cost - newCost) / temperature)) {
+                    s.cost = newCost;
+                } else {
+                    switch (kind) {
+                        case 0: std::swap(s.order[i], s.order[j]); std::swap(s.rotated[i], s.rotated[j]); break;
+                        case 1: moveRect(j, i); break;
+                        case 2: s.rotated[i] = !s.rotated[i]; break;
+                    }
+                }
+            }
+        });
+        evaluations += stepEvaluations;
+        newRound = false;
+
+        // The first searcher that fits everything in the target wins, its packer holds the layout
+        auto winner = std::find_if(searchers.begin(), searchers.end(), [](const OrderSearcher &s) { return s.cost == 0; });
+        if (winner == searchers.end()) {
+            continue;
+        }
+        rbp::BinPack &packer = *winner->packer;
+        result.w = AtlasSize(options, packer.GetOccupiedWidth()-options.padx);
+        result.h = AtlasSize(options, packer.GetOccupiedHeight()-options.pady);
+        if (options.forceSquare) {
+            result.w = result.h = std::max(result.w, result.h);
+        }
+        result.usedRects = packer.GetUsedRectangles();
+        for (size_t k = 0; k < result.usedRects.size(); ++k) {
+            result.usedRects[k].flipped = winner->rotated[k] != 0;
+        }
+        result.fill = Fill(packer);
+        startOrder = winner->order;
+        startRotated = winner->rotated;
+        done = !NextSearchTarget(options, bounds, result.w, result.h, targetw, targeth);
+        newRound = true;
+    }
+
+    long long total = evaluations * numSearchers;
+    if (result.w != startw || result.h != starth) {
+        printf("Order search found %d x %d instead of %d x %d in %lld evaluations\n", result.w, result.h, startw, starth, total);
+    } else {
+        printf("Order search found nothing smaller than %d x %d in %lld evaluations\n", startw, starth, total);
+    }
+}
+
+// ------------------
+// Compaction
+// ------------------
+
+// Widest strip along the edges repacked by the compaction, in times the biggest rect out
+const int MAX_COMPACT_BAND = 8;
+
+// Place the rects again in a bin of binw x binh. The ones inside it stay where they are, and the ones sticking
+// out are inserted into the free space left. With a band, the rects in a strip along each edge they stick out
+// of are repacked with them, the strip being band times as wide as the biggest rect out.
+bool CompactInto(const Options &options, std::vector<rbp::Rect> &usedRects, int binw, int binh, int band)
+{
+    int bandw = 0;
+    int bandh = 0;
+    if (band) {
+        for (const auto &r: usedRects) {
+            if (r.x + r.width > binw) {
+                bandw = std::max(bandw, r.width*band);
+            }
+            if (r.y + r.height > binh) {
+                bandh = std::max(bandh, r.height*band);
+            }
+        }
+    }
+
+    std::vector<rbp::Rect> kept;
+    std::vector<rbp::RectSize> moved;
+    long long freeArea = (long long)binw*binh;
+    long long movedArea = 0;
+    for (const auto &r: usedRects) {
+        if (r.x + r.width <= binw - bandw && r.y + r.height <= binh - bandh) {
+            kept.push_back(r);
+            freeArea -= (long long)r.width*r.height;
+        } else {
+            rbp::RectSize s = { r.flipped? r.height : r.width, r.flipped? r.width : r.height, r.image };
+            moved.push_back(s);
+            movedArea += (long long)r.width*r.height;
+        }
+    }
+    if (moved.empty() || movedArea > freeArea) {
+        return moved.empty();
+    }
+
+    rbp::MaxRectsBinPack packer(binw, binh);
+    for (const auto &r: kept) {
+        packer.PlaceRect(r);
+    }
+    if (!packer.Insert(moved, options.allowFlipping)) {
+        return false;
+    }
+    usedRects = packer.GetUsedRectangles();
+    return true;
+}
+
+// Packing often ends just past a power of 2, and the atlas doubles for a few rects. Halve the atlas,
+// the longer side first, as long as the rects past the smaller size fit in the space left inside it.
+void CompactLayout(const Options &options, PackResult &result)
+{
+    // The rects of the mask algorithm overlap, MaxRects cannot keep them in place
+    if (options.npot || options.algorithm == Options::ALGORITHM_MASK || result.usedRects.empty()) {
+        return;
+    }
+    int startw = result.w;
+    int starth = result.h;
+    int minw = AtlasSize(options, options.minw);
+    int minh = AtlasSize(options, options.minh);
+    bool shrunk = true;
+    while (shrunk) {
+        shrunk = false;
+        std::vector<std::pair<int, int>> sizes;
+        if (options.forceSquare) {
+            sizes.push_back(std::make_pair(result.w/2, result.h/2));
+        } else if (result.w >= result.h) {
+            sizes.push_back(std::make_pair(result.w/2, result.h));
+            sizes.push_back(std::make_pair(result.w, result.h/2));
+        } else {
+            sizes.push_back(std::make_pair(result.w, result.h/2));
+            sizes.push_back(std::make_pair(result.w/2, result.h));
+        }
+        for (const auto &s: sizes) {
+            if (s.first < minw || s.second < minh) {
+                continue;
+            }
+            int binw = s.first + options.padx;
+            int binh = s.second + options.pady;
+            // Move only the rects out, then repack wider and wider strips along the edges
+            bool fits = CompactInto(options, result.usedRects, binw, binh, 0);
+            for (int band = 1; band <= MAX_COMPACT_BAND && !fits; band *= 2) {
+                fits = CompactInto(options, result.usedRects, binw, binh, band);
+            }
+            if (fits) {
+                result.w = s.first;
+                result.h = s.second;
+                shrunk = true;
+                break;
+            }
+        }
+    }
+    if (result.w == startw && result.h == starth) {
+        return;
+    }
+
+    long long usedArea = 0;
+    int occupiedw = 0;
+    int occupiedh = 0;
+    for (const auto &r: result.usedRects) {
+        usedArea += (long long)r.width*r.height;
+        occupiedw = std::max(occupiedw, r.x + r.width);
+        occupiedh = std::max(occupiedh, r.y + r.height);
+    }
+    result.fill = (float)usedArea / ((long long)occupiedw*occupiedh);
+    printf("Compacted the atlas to %d x %d from %d x %d\n", result.w, result.h, startw, starth);
+}
+
+// ------------------
+// Multiple pages
+// ------------------
+
+// Pack the rects of one page at each size of the growth loop, or with every heuristic in -best mode
+bool PackPage(const Options &options, const std::vector<rbp::RectSize> &rects, PackResult &result)
+{
+    return options.best? PackBest(options, rects, result) : PackRects(options, rects, PackSettings(options), result);
+}
+
+// Split the rects among as few pages of the maximum size as possible. The page count comes from filling
+// maximum size pages one after another. The rects are then spread over that many pages, biggest first into
+// the page with the least area used so far, so all pages end up similarly full. If that does not fit,
+// one more page is tried, and finally the pages from the first pass are used as they are. The first pass fills
+// pages of the largest atlas size allowed, so its pages never grow past the maximum.
+bool PackPages(const Options &options, const std::vector<rbp::RectSize> &srcRects, std::vector<PackResult> &pages)
+{
+    PackSettings settings(options);
+    int maxw = LargestAtlasSize(options, options.forceSquare? std::min(options.maxw, options.maxh) : options.maxw);
+    int maxh = options.forceSquare? maxw : LargestAtlasSize(options, options.maxh);
+
+    std::vector<std::vector<rbp::RectSize> > greedy;
+    std::vector<PackResult> greedyPages;
+    std::vector<rbp::RectSize> remaining = srcRects;
+    SortRects(remaining, settings.sortOrder);
+    std::unique_ptr<rbp::BinPack> packer = CreateBinPack(settings);
+    while (!remaining.empty()) {
+        std::vector<rbp::RectSize> page = remaining;
+        packer->Init(maxw+options.padx, maxh+options.pady);
+        packer->Insert(remaining, options.allowFlipping);
+        if (remaining.size() == page.size()) {
+            fprintf(stderr, "Error: impossible to fit image %s (%d x %d) in %d x %d\n", remaining[0].image->filename.c_str(),
+                remaining[0].width-options.padx, remaining[0].height-options.pady, maxw, maxh);
+            return false;
+        }
+        // The page keeps the rects that were placed, in their order
+        std::set<Image*> left;
+        for (const auto &r: remaining) {
+            left.insert(r.image);
+        }
+        page.erase(std::remove_if(page.begin(), page.end(), [&](const rbp::RectSize &r) { return left.count(r.image) != 0; }), page.end());
+        greedy.push_back(page);
+        PackResult result;
+        result.w = AtlasSize(options, std::max(packer->GetOccupiedWidth()-options.padx, options.minw));
+        result.h = AtlasSize(options, std::max(packer->GetOccupiedHeight()-options.pady, options.minh));
+        if (options.forceSquare) {
+            result.w = result.h = std::max(result.w, result.h);
+        }
+        result.usedRects = packer->GetUsedRectangles();
+        result.fill = Fill(*packer);
+        greedyPages.push_back(result);
+    }
+
+    std::vector<rbp::RectSize> byArea = srcRects;
+    SortRects(byArea, SORT_AREA);
+    for (int numPages = (int)greedy.size(); numPages <= (int)greedy.size() + 1; ++numPages) {
+        std::vector<std::vector<rbp::RectSize> > balanced(numPages);
+        std::vector<long long> area(numPages, 0);
+        for (const auto &r: byArea) {
+            int p = (int)(std::min_element(area.begin(), area.end()) - area.begin());
+            balanced[p].push_back(r);
+            area[p] += (long long)r.width*r.height;
+        }
+        std::vector<PackResult> results(numPages);
+        std::vector<char> valid(numPages);
+        ParallelFor(numPages, [&](int p) {
+            valid[p] = PackPage(options, balanced[p], results[p]);
+        });
+        if (std::find(valid.begin(), valid.end(), 0) == valid.end()) {
+            pages.swap(results);
+            printf("Packed in %d pages\n", numPages);
+            return true;
+        }
+    }
+
+    // The pages of the first pass keep their places, in the smallest atlas size that holds them
+    pages.swap(greedyPages);
+    printf("Packed in %d pages\n", (int)pages.size());
+    return true;
+}
+
+// ------------------
+// Stable layout
+// ------------------
+
+// A frame of the map file of a previous run
+struct PreviousFrame {
+    int page;
+    int x, y, w, h;     // Placed size, sides swapped if rotated
+    bool rotated;
+};
+
+// Read the frames of a map file in any of the output formats, by the file name of their image. All the
+// formats write one frame per line.
+bool ReadPreviousLayout(const std::string &path, std::map<std::string, PreviousFrame> &frames)
+{
+    FILE *f = fopen(path.c_str(), "rt");
+    if (!f) {
+        return false;
+    }
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        PreviousFrame frame = { 0, 0, 0, 0, 0, false };
+        std::string name;
+        bool parsed = false;
+        const char *s = nullptr;
+        if ((s = strstr(line, "\"frame\":")) != nullptr) {
+            // json-array names the frame in its filename field, json-hash by its key
+            const char *quote = strstr(line, "\"filename\":\"");
+            quote = quote? quote + 11 : strchr(line, '"');
+            const char *end = strchr(quote + 1, '"');
+            if (end && end < s) {
+                name.assign(quote + 1, end);
+            }
+            parsed = sscanf(s, "\"frame\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d}", &frame.x, &frame.y, &frame.w, &frame.h) == 4;
+            frame.rotated = strstr(s, "\"rotated\":true") != nullptr;
+            if ((s = strstr(s, "\"page\":")) != nullptr) {
+                sscanf(s, "\"page\":%d", &frame.page);
+            }
+        } else if ((s = strstr(line, "<key>frame</key>")) != nullptr) {
+            const char *key = strstr(line, "<key>");
+            const char *end = strstr(key, "</key>");
+            if (end < s) {
+                name.assign(key + 5, end);
+            }
+            parsed = sscanf(s, "<key>frame</key><string>{{%d,%d},{%d,%d}}", &frame.x, &frame.y, &frame.w, &frame.h) == 4;
+            frame.rotated = strstr(s, "<key>rotated</key><true/>") != nullptr;
+            if ((s = strstr(s, "<key>page</key><integer>")) != nullptr) {
+                sscanf(s, "<key>page</key><integer>%d", &frame.page);
+            }
+        } else if (strncmp(line, "atlas:", 6) != 0 && (s = strstr(line, ": ")) != nullptr) {
+            name.assign(line, s - line);
+            parsed = sscanf(s, ": %d,%d x %d,%d", &frame.x, &frame.y, &frame.w, &frame.h) == 4;
+            frame.rotated = strstr(s, " rotated") != nullptr;
+            if ((s = strstr(s, " page ")) != nullptr) {
+                sscanf(s, " page %d", &frame.page);
+            }
+        }
+        if (parsed && !name.empty()) {
+            frames[name] = frame;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+// Keep the images where the map file of a previous run placed them, if they still have the same size, and
+// place the new or resized ones in the space left. Pages grow up to the maximum size as needed, then new
+// pages are added. Fails without a previous map file, or when the atlas ends up less full than asked.
+bool PackStable(const Options &options, const std::vector<rbp::RectSize> &srcRects, std::vector<PackResult> &pages)
+{
+    std::map<std::string, PreviousFrame> previous;
+    if (!ReadPreviousLayout(options.stableMap, previous)) {
+        printf("No previous map file %s, packing from scratch\n", options.stableMap.c_str());
+        return false;
+    }
+    int maxw = options.forceSquare? std::min(options.maxw, options.maxh) : options.maxw;
+    int maxh = options.forceSquare? maxw : options.maxh;
+    int block = std::max(1, options.blockAlign);
+
+    // Sort out the rects that keep their place, per page, from the ones to place again
+    std::vector<std::vector<rbp::Rect> > kept;
+    std::vector<rbp::RectSize> left;
+    int numKept = 0;
+    long long usedArea = 0;
+    for (const auto &r: srcRects) {
+        usedArea += (long long)r.width*r.height;
+        auto it = previous.find(filename(r.image->filename));
+        bool keep = it != previous.end();
+        if (keep) {
+            const PreviousFrame &f = it->second;
+            rbp::Rect placed = { f.x, f.y, f.rotated? r.height : r.width, f.rotated? r.width : r.height, r.image, f.rotated };
+            keep = (f.rotated? f.h : f.w) == r.image->fillw && (f.rotated? f.w : f.h) == r.image->fillh &&
+                (!f.rotated || options.allowFlipping) && f.page >= 0 && f.page < (int)srcRects.size() &&
+                f.x >= 0 && f.y >= 0 && f.x % block == 0 && f.y % block == 0 &&
+                f.x + placed.width <= maxw + options.padx && f.y + placed.height <= maxh + options.pady;
+            if (keep && (int)kept.size() <= f.page) {
+                kept.resize(f.page + 1);
+            }
+            // With other padding or duplicate names, the old places may overlap
+            for (size_t k = 0; keep && k < kept[f.page].size(); ++k) {
+                const rbp::Rect &o = kept[f.page][k];
+                keep = placed.x >= o.x + o.width || o.x >= placed.x + placed.width || placed.y >= o.y + o.height || o.y >= placed.y + placed.height;
+            }
+            if (keep) {
+                kept[f.page].push_back(placed);
+                ++numKept;
+            }
+        }
+        if (!keep) {
+            left.push_back(r);
+        }
+    }
+
+    std::vector<PackResult> results;
+    long long atlasArea = 0;
+    for (int p = 0; p < (int)kept.size() || !left.empty(); ++p) {
+        // Start from the size that holds the kept rects, and grow the shorter side while the others do not fit
+        std::vector<rbp::Rect> pageKept;
+        if (p < (int)kept.size()) {
+            pageKept.swap(kept[p]);
+        }
+        int w = AtlasSize(options, options.minw);
+        int h = AtlasSize(options, options.minh);
+        for (const auto &r: pageKept) {
+            w = std::max(w, AtlasSize(options, r.x + r.width - options.padx));
+            h = std::max(h, AtlasSize(options, r.y + r.height - options.pady));
+        }
+        if (options.forceSquare) {
+            w = h = std::max(w, h);
+        }
+        rbp::MaxRectsBinPack packer(w + options.padx, h + options.pady);
+        for (const auto &r: pageKept) {
+            packer.PlaceRect(r);
+        }
+        while (!packer.Insert(left, options.allowFlipping) && (w < maxw || h < maxh)) {
+            if (options.forceSquare) {
+                w = h = std::min(w*2, maxw);
+            } else if ((w <= h && w < maxw) || h >= maxh) {
+                w = std::min(w*2, maxw);
+            } else {
+                h = std::min(h*2, maxh);
+            }
+            packer.Grow(w + options.padx, h + options.pady);
+        }
+        if (packer.GetUsedRectangles().empty()) {
+            if (p >= (int)kept.size()) {
+                // Not even an empty page holds the rect, packing from scratch reports it
+                return false;
+            }
+            continue;
+        }
+        PackResult result;
+        result.w = AtlasSize(options, std::max(packer.GetOccupiedWidth()-options.padx, options.minw));
+        result.h = AtlasSize(options, std::max(packer.GetOccupiedHeight()-options.pady, options.minh));
+        if (options.forceSquare) {
+            result.w = result.h = std::max(result.w, result.h);
+        }
+        result.usedRects = packer.GetUsedRectangles();
+        result.fill = Fill(packer);
+        atlasArea += (long long)result.w*result.h;
+        results.push_back(result);
+    }
+
+    int fillPercent = (int)(usedArea*100 / std::max(atlasArea, 1LL));
+    if (fillPercent < options.stableFill) {
+        printf("The stable layout fills %d%% of the atlas, less than %d%%, packing from scratch\n", fillPercent, options.stableFill);
+        return false;
+    }
+    pages.swap(results);
+    printf("Kept %d of %d images in their previous place, the atlas is %d%% full\n", numKept, (int)srcRects.size(), fillPercent);
+    return true;
+}
+
+// ------------------
+// Pinned images
+// ------------------
+
+// Rects of the images pinned to fixed places and of the reserved areas, which have no image. The other
+// rects, to pack around them, go to packRects.
+std::vector<rbp::Rect> PinnedRects(const Options &options, const std::vector<rbp::RectSize> &srcRects, std::vector<rbp::RectSize> &packRects)
+{
+    std::vector<rbp::Rect> occupied;
+    std::vector<const Options::Pin *> pinOf(srcRects.size(), nullptr);
+    for (const auto &pin: options.pins) {
+        bool found = false;
+        for (size_t i = 0; i < srcRects.size(); ++i) {
+            if (filename(srcRects[i].image->filename) == pin.name && !pinOf[i]) {
+                pinOf[i] = &pin;
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Error: pinned image %s is not among the input images\n", pin.name.c_str());
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < srcRects.size(); ++i) {
+        if (!pinOf[i]) {
+            packRects.push_back(srcRects[i]);
+            continue;
+        }
+        rbp::Rect r = { pinOf[i]->x, pinOf[i]->y, srcRects[i].width, srcRects[i].height, srcRects[i].image, false };
+        occupied.push_back(r);
+    }
+    // Reserved areas keep the padding from the images after them, like images do, and cover whole blocks
+    int block = std::max(1, options.blockAlign);
+    for (const auto &region: options.reserved) {
+        int x = region.x / block * block;
+        int y = region.y / block * block;
+        int right = (region.x + region.w + options.padx + block - 1) / block * block;
+        int bottom = (region.y + region.h + options.pady + block - 1) / block * block;
+        rbp::Rect r = { x, y, right - x, bottom - y, nullptr, false };
+        occupied.push_back(r);
+    }
+
+    for (size_t i = 0; i < occupied.size(); ++i) {
+        const rbp::Rect &r = occupied[i];
+        if (r.x < 0 || r.y < 0 || r.x + r.width - options.padx > options.maxw || r.y + r.height - options.pady > options.maxh) {
+            fprintf(stderr, "Error: %s at %d,%d x %d,%d is outside %d x %d\n", r.image? r.image->filename.c_str() : "reserved area",
+                r.x, r.y, r.width - options.padx, r.height - options.pady, options.maxw, options.maxh);
+            exit(1);
+        }
+        if (r.x % block != 0 || r.y % block != 0) {
+            fprintf(stderr, "Error: %s at %d,%d does not start on a %d pixel block\n", r.image->filename.c_str(), r.x, r.y, block);
+            exit(1);
+        }
+        for (size_t j = 0; j < i; ++j) {
+            const rbp::Rect &o = occupied[j];
+            if (r.x < o.x + o.width && o.x < r.x + r.width && r.y < o.y + o.height && o.y < r.y + r.height) {
+                fprintf(stderr, "Error: %s at %d,%d overlaps %s at %d,%d\n", r.image? r.image->filename.c_str() : "reserved area",
+                    r.x, r.y, o.image? o.image->filename.c_str() : "reserved area", o.x, o.y);
+                exit(1);
+            }
+        }
+    }
+    return occupied;
+}
+
+// Pack the rects around the pinned images and reserved areas, with the Guillotine packer cut around them. The
+// atlas starts at the size that holds them, and the shorter side doubles while the rects do not fit.
+bool PackPinned(const Options &options, const std::vector<rbp::RectSize> &rects, const std::vector<rbp::Rect> &occupied, PackResult &result)
+{
+    PackSettings settings(options);
+    if (settings.algorithm != Options::ALGORITHM_GUILLOTINE) {
+        printf("Packing around pinned images and reserved areas with the guillotine algorithm\n");
+        settings = PackSettings();
+    }
+    int maxw = options.forceSquare? std::min(options.maxw, options.maxh) : options.maxw;
+    int maxh = options.forceSquare? maxw : options.maxh;
+    int w = AtlasSize(options, options.minw);
+    int h = AtlasSize(options, options.minh);
+    for (const auto &r: occupied) {
+        w = std::max(w, AtlasSize(options, r.x + r.width - options.padx));
+        h = std::max(h, AtlasSize(options, r.y + r.height - options.pady));
+    }
+    if (options.forceSquare) {
+        w = h = std::max(w, h);
+    }
+
+    rbp::GuillotineBinPack packer;
+    packer.SetHeuristics(settings.rectChoice, settings.splitMethod, settings.merge);
+    while (true) {
+        std::vector<rbp::RectSize> left = rects;
+        packer.Init(w + options.padx, h + options.pady, occupied);
+        if (packer.Insert(left, options.allowFlipping)) {
+            break;
+        }
+        if (w >= maxw && h >= maxh) {
+            fprintf(stderr, "Error: %d images do not fit in %d x %d around the pinned images and reserved areas\n", (int)left.size(), maxw, maxh);
+            return false;
+        }
+        if (options.forceSquare) {
+            w = h = std::min(w*2, maxw);
+        } else if ((w <= h && w < maxw) || h >= maxh) {
+            w = std::min(w*2, maxw);
+        } else {
+            h = std::min(h*2, maxh);
+        }
+    }
+    result.w = AtlasSize(options, std::max(packer.GetOccupiedWidth()-options.padx, options.minw));
+    result.h = AtlasSize(options, std::max(packer.GetOccupiedHeight()-options.pady, options.minh));
+    if (options.forceSquare) {
+        result.w = result.h = std::max(result.w, result.h);
+    }
+    result.usedRects = packer.GetUsedRectangles();
+    result.fill = Fill(packer);
+    return true;
+}
+
+// ------------------
+// Output
+// ------------------
+
+// An image with the same pixels as a packed image, or a part of it, once transformed
+struct ImageAlias {
+    Image *image;
+    int transform;  // Image::Transform that turns the part of the packed image into this one
+    int x, y;       // Position of the part in the fill area of the packed image
+};
+
+// Aliases keyed by the packed image
+typedef std::map<Image*, std::vector<ImageAlias> > AliasMap;
+
+// Pinned images are found by their file names, so they must stay packed as themselves, never as aliases
+bool IsPinned(const Options &options, const Image &image)
+{
+    std::string name = filename(image.filename);
+    return std::any_of(options.pins.begin(), options.pins.end(), [&](const Options::Pin &pin) { return pin.name == name; });
+}
+
+// The number of transforms -dedup looks for: none, the mirrors, or with -rot also the 90 deg rotations
+int NumDedupTransforms(const Options &options)
+{
+    if (!options.dedupFlip) {
+        return 1;
+    }
+    return options.allowFlipping? Image::NUM_TRANSFORMS : Image::TRANSFORM_TRANSPOSE;
+}
+
+// Hash of the image that -dedup groups by. With mirrors it is the smallest hash of all the transforms looked for,
+// which is the same for every transformed copy of the image.
+uint64_t DedupHash(const Options &options, const Image &image)
+{
+    if (!options.dedupFlip) {
+        return image.HashFillArea();
+    }
+    uint64_t hashes[Image::NUM_TRANSFORMS];
+    image.HashFillAreaTransforms(hashes);
+    return *std::min_element(hashes, hashes + NumDedupTransforms(options));
+}
+
+// Transforms as 2x2 matrices that act on pixel positions relative to the center of the image
+void TransformMatrix(int transform, int m[4])
+{
+    bool transpose = (transform & Image::TRANSFORM_TRANSPOSE) != 0;
+    int sx = (transform & Image::TRANSFORM_FLIP_X)? -1 : 1;
+    int sy = (transform & Image::TRANSFORM_FLIP_Y)? -1 : 1;
+    m[0] = transpose? 0 : sx;
+    m[1] = transpose? sx : 0;
+    m[2] = transpose? sy : 0;
+    m[3] = transpose? 0 : sy;
+}
+
+// The transform that applies first and then second
+int ComposeTransforms(int first, int second)
+{
+    int a[4], b[4], m[4];
+    TransformMatrix(first, a);
+    TransformMatrix(second, b);
+    int product[4] = { b[0]*a[0] + b[1]*a[2], b[0]*a[1] + b[1]*a[3], b[2]*a[0] + b[3]*a[2], b[2]*a[1] + b[3]*a[3] };
+    for (int t = 0; t < Image::NUM_TRANSFORMS; ++t) {
+        TransformMatrix(t, m);
+        if (std::equal(m, m + 4, product)) {
+            return t;
+        }
+    }
+    return 0; // unreachable, the transforms are a group
+}
+
+// Rotation and mirrors in the frame of an image that is the packed image transformed by transform, when the packed
+// image was rotated clockwise or not into its area. TRANSFORM_TRANSPOSE stands for the usual rotated frame, undone
+// by rotating counter clockwise, and the mirrors apply after that.
+int FrameTransform(bool packedRotated, int transform)
+{
+    const int cw = Image::TRANSFORM_TRANSPOSE | Image::TRANSFORM_FLIP_X;
+    const int ccw = Image::TRANSFORM_TRANSPOSE | Image::TRANSFORM_FLIP_Y;
+    // The area holds the image undone by its transform, then rotated
+    int inverse = 0;
+    while (ComposeTransforms(transform, inverse) != 0) {
+        ++inverse;
+    }
+    int toArea = ComposeTransforms(inverse, packedRotated? cw : 0);
+    for (int flags = 0; flags < Image::NUM_TRANSFORMS; ++flags) {
+        int rotation = (flags & Image::TRANSFORM_TRANSPOSE)? ccw : 0;
+        if (ComposeTransforms(toArea, ComposeTransforms(rotation, flags & ~Image::TRANSFORM_TRANSPOSE)) == 0) {
+            return flags;
+        }
     }
+    return 0; // unreachable
+}
+
+// Keep the first of each set of images with identical fill areas and record the rest as its aliases. Images are
+// grouped by the hash of their pixels, and the pixels are compared in full before two are taken as equal. With
+// -dedupflip the pixels are compared under each transform, and the first that matches is recorded. Pinned images
+// are visited first and always kept, so their copies become their aliases.
+std::vector<Image*> RemoveDuplicates(const Options &options, const std::vector<Image*> &images, const std::vector<uint64_t> &hashes, AliasMap &aliases)
+{
+    std::vector<Image*> unique;
+    std::map<uint64_t, std::vector<Image*> > byHash;
+    int numTransforms = NumDedupTransforms(options);
+    size_t savedArea = 0;
+    std::vector<size_t> order(images.size());
+    for (size_t i = 0; i < images.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_partition(order.begin(), order.end(), [&](size_t i) { return IsPinned(options, *images[i]); });
+    for (size_t i: order) {
+        Image *image = images[i];
+        std::vector<Image*> &candidates = byHash[hashes[i]];
+        ImageAlias alias = { image, -1, 0, 0 };
+        Image *same = nullptr;
+        size_t numCandidates = IsPinned(options, *image)? 0 : candidates.size();
+        for (size_t c = 0; c < numCandidates && !same; ++c) {
+            for (int t = 0; t < numTransforms && !same; ++t) {
+                if (candidates[c]->SameFillArea(*image, t)) {
+                    same = candidates[c];
+                    alias.transform = t;
+                }
+            }
+        }
+        if (same) {
+            aliases[same].push_back(alias);
+            savedArea += (size_t)image->fillw*image->fillh;
+        } else {
+            candidates.push_back(image);
+            unique.push_back(image);
+        }
+    }
+    if (unique.size() < images.size()) {
+        printf("%d duplicate images share the area of %d others, saving %d pixels\n",
+            (int)(images.size() - unique.size()), (int)aliases.size(), (int)savedArea);
+    }
+    return unique;
+}
+
+// The pixel at p as a single value, for hashing runs of pixels
+inline uint32_t PixelValue(const unsigned char *p, int ncomps)
+{
+    uint32_t v = 0;
+    for (int k = 0; k < ncomps; ++k) {
+        v |= (uint32_t)p[k] << (k*8);
+    }
+    return v;
+}
+
+// Longest run of pixels hashed to find where an image may be inside another
+const int CropAnchorSize = 8;
+
+// Images found inside the fill area of a bigger image become its aliases at their place in it, and so do their own
+// aliases. Each image is anchored by the run of pixels that starts at the first visible pixel of its top row, up to
+// CropAnchorSize long. The bigger images are scanned with a rolling hash of each anchor length, and the places where
+// the hash of an anchor comes up are compared in full. Images are visited from the biggest, so an image inside one
+// that is itself inside another becomes part of the outermost one. Pinned images get no anchor, so they are never
+// found inside others.
+std::vector<Image*> RemoveCrops(const Options &options, const std::vector<Image*> &images, AliasMap &aliases)
+{
+    const uint64_t Base = 0x100000001B3ull;
+    int count = (int)images.size();
+    std::vector<int> order(count);
+    for (int i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return (int64_t)images[a]->fillw*images[a]->fillh > (int64_t)images[b]->fillw*images[b]->fillh;
+    });
+    std::vector<int> rank(count);
+    for (int i = 0; i < count; ++i) {
+        rank[order[i]] = i;
+    }
+
+    // Anchor hashes of each length
+    std::vector<int> anchorX(count, -1);
+    std::map<int, std::unordered_map<uint64_t, std::vector<int> > > anchors;
+    for (int i = 0; i < count; ++i) {
+        const Image *image = images[i];
+        if (image->fillw <= 0 || image->fillh <= 0 || IsPinned(options, *image)) {
+            continue;
+        }
+        const unsigned char *row = image->at(image->fillx, image->filly);
+        int x = 0;
+        while (image->ncomps == 4 && x < image->fillw && row[x*4+3] == 0) {
+            ++x;
+        }
+        if (x == image->fillw) {
+            continue;
+        }
+        int length = std::min(CropAnchorSize, image->fillw - x);
+        uint64_t hash = 0;
+        for (int k = 0; k < length; ++k) {
+            hash = hash*Base + PixelValue(row + (x+k)*image->ncomps, image->ncomps);
+        }
+        anchorX[i] = x;
+        anchors[length][hash].push_back(i);
+    }
+
+    std::vector<bool> aliased(count, false);
+    std::vector<uint32_t> pixels;
+    int numCrops = 0;
+    size_t savedArea = 0;
+    for (int o = 0; o < count; ++o) {
+        Image *container = images[order[o]];
+        if (aliased[order[o]] || container->fillw <= 0 || container->fillh <= 0) {
+            continue;
+        }
+        int fw = container->fillw;
+        int ncomps = container->ncomps;
+        pixels.resize(fw);
+        for (const auto &byLength: anchors) {
+            int length = byLength.first;
+            if (length > fw) {
+                continue;
+            }
+            uint64_t outPower = 1;
+            for (int k = 1; k < length; ++k) {
+                outPower *= Base;
+            }
+            for (int y = 0; y < container->fillh; ++y) {
+                const unsigned char *row = container->at(container->fillx, container->filly+y);
+                for (int x = 0; x < fw; ++x) {
+                    pixels[x] = PixelValue(row + x*ncomps, ncomps);
+                }
+                uint64_t hash = 0;
+                for (int x = 0; x < fw; ++x) {
+                    if (x >= length) {
+                        hash -= pixels[x-length]*outPower;
+                    }
+                    hash = hash*Base + pixels[x];
+                    int start = x - length + 1;
+                    // Anchors start at a visible pixel
+                    if (start < 0 || (ncomps == 4 && (pixels[start] >> 24) == 0)) {
+                        continue;
+                    }
+                    auto it = byLength.second.find(hash);
+                    if (it == byLength.second.end()) {
+                        continue;
+                    }
+                    for (int a: it->second) {
+                        int dx = start - anchorX[a];
+                        if (aliased[a] || rank[a] <= o || !container->ContainsFillArea(*images[a], dx, y)) {
+                            continue;
+                        }
+                        aliased[a] = true;
+                        ++numCrops;
+                        savedArea += (size_t)images[a]->fillw*images[a]->fillh;
+                        std::vector<ImageAlias> &containerAliases = aliases[container];
+                        ImageAlias crop = { images[a], 0, dx, y };
+                        containerAliases.push_back(crop);
+                        auto inner = aliases.find(images[a]);
+                        if (inner != aliases.end()) {
+                            for (ImageAlias alias: inner->second) {
+                                alias.x += dx;
+                                alias.y += y;
+                                containerAliases.push_back(alias);
+                            }
+                            aliases.erase(inner);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    std::vector<Image*> remaining;
+    for (int i = 0; i < count; ++i) {
+        if (!aliased[i]) {
+            remaining.push_back(images[i]);
+        }
+    }
+    if (numCrops > 0) {
+        printf("%d images are parts of others, saving %d pixels\n", numCrops, (int)savedArea);
+    }
+    return remaining;
+}
 
-    // Build resulting atlas image
-    // Save map file with correct format
-    Image dest(w, h, 4);
+// Save the page images and the map file with all the frames, in the chosen format. A single page keeps the
+// output filename; with several pages, each page image gets its index appended and every frame records its page.
+// The duplicates of a packed image, and the images found inside it, get frames of their own on its area of the atlas. With -dedupflip, every
+// frame tells how to mirror its area, after undoing the rotation, to get the image back.
+void SaveAtlas(const Options &options, std::vector<PackResult> &pages, const AliasMap &aliases)
+{
     std::string mapExtension;
     switch (options.format) {
         case Options::FORMAT_TXT: mapExtension = ".txt"; break;
@@ -165,19 +1976,43 @@ void ImagePack(const Options &options)
         case Options::FORMAT_JSON_ARRAY: mapExtension = ".json"; break;
         case Options::FORMAT_PLIST: mapExtension = ".plist"; break;
     }
+    bool multiPage = pages.size() > 1;
     std::string outMapFilename = basename(options.outfile) + mapExtension;
-    std::string outImageFilename = basename(options.outfile) + ".png";
+    std::vector<std::string> outImageFilenames;
+    for (int p = 0; p < (int)pages.size(); ++p) {
+        if (multiPage) {
+            char suffix[32];
+            snprintf(suffix, sizeof(suffix), "_%d.png", p);
+            outImageFilenames.push_back(basename(options.outfile) + suffix);
+        } else {
+            outImageFilenames.push_back(basename(options.outfile) + ".png");
+        }
+    }
+    std::string pagesMeta;
+    if (multiPage) {
+        pagesMeta = ",\"pages\":[";
+        for (int p = 0; p < (int)pages.size(); ++p) {
+            char meta[512];
+            snprintf(meta, sizeof(meta), "%s{\"image\":\"%s\",\"size\":{\"w\":%d,\"h\":%d}}", p == 0? "" : ",",
+                filename(outImageFilenames[p]).c_str(), pages[p].w, pages[p].h);
+            pagesMeta += meta;
+        }
+        pagesMeta += "]";
+    }
 
     FILE *mapf = fopen(outMapFilename.c_str(), "wt");
+    if (!mapf) {
+        fprintf(stderr, "Error: can't write map file %s\n", outMapFilename.c_str());
+        exit(1);
+    }
     switch (options.format) {
         case Options::FORMAT_TXT:
-            fprintf(mapf, "atlas: \"%s\" %d,%d total %d\n", filename(outImageFilename).c_str(), w, h, (int)binPacker.GetUsedRectangles().size());
             break;
         case Options::FORMAT_JSON_HASH:
-            fprintf(mapf, "{\"meta\": {\"app\":\"imgp\",\"version\":\"%s\",\"image\":\"%s\",\"size\":{\"w\":%d,\"h\":%d}},\n \"frames\": {\n", Options::version, filename(outImageFilename).c_str(), w, h);
+            fprintf(mapf, "{\"meta\": {\"app\":\"imgp\",\"version\":\"%s\",\"image\":\"%s\",\"size\":{\"w\":%d,\"h\":%d}%s},\n \"frames\": {\n", Options::version, filename(outImageFilenames[0]).c_str(), pages[0].w, pages[0].h, pagesMeta.c_str());
             break;
         case Options::FORMAT_JSON_ARRAY:
-            fprintf(mapf, "{\"meta\": {\"app\":\"imgp\",\"version\":\"%s\",\"image\":\"%s\",\"size\":{\"w\":%d,\"h\":%d}},\n \"frames\": [\n", Options::version, filename(outImageFilename).c_str(), w, h);
+            fprintf(mapf, "{\"meta\": {\"app\":\"imgp\",\"version\":\"%s\",\"image\":\"%s\",\"size\":{\"w\":%d,\"h\":%d}%s},\n \"frames\": [\n", Options::version, filename(outImageFilenames[0]).c_str(), pages[0].w, pages[0].h, pagesMeta.c_str());
             break;
         case Options::FORMAT_PLIST:
             fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?><!DOCTYPE plist PUBLIC \"-//Apple Computer//DTD PLIST 1.0//EN\" \"http://www.apple.com/DTDs/PropertyList-1.0.dtd\">"
@@ -185,56 +2020,119 @@ void ImagePack(const Options &options)
             break;
     }
     bool firstImage = true;
-    for (const auto &r: binPacker.GetUsedRectangles()) {
-        if (r.flipped) {
-            r.image->Rotate();
-        }
-        // std::string saneFilename = ReplaceString(r.image->filename, "\\", "/");
-        std::string saneFilename = filename(r.image->filename);
-        switch (options.format) {
-            case Options::FORMAT_TXT:
-                fprintf(mapf, "%s: %d,%d x %d,%d offset %d,%d orgsize %d,%d %s\n",
-                    saneFilename.c_str(),
-                    r.x, r.y, r.image->fillw, r.image->fillh,
-                    r.image->fillx, r.image->filly, r.image->w, r.image->h,
-                    r.flipped? "rotated" : "original");
-                break;
-            case Options::FORMAT_JSON_HASH:
-                fprintf(mapf,
-                    "%s\"%s\": { \"frame\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"rotated\":%s,\"trimmed\":%s,\"spriteSourceSize\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"sourceSize\":{\"w\":%d,\"h\":%d}}\n",
-                    firstImage? " " : ",",
-                    saneFilename.c_str(),
-                    r.x, r.y, r.image->fillw, r.image->fillh,
-                    r.flipped? "true" : "false",
-                    (r.image->w!=r.image->fillw || r.image->h!=r.image->fillh)? "true" : "false",
-                    r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh,
-                    r.image->w, r.image->h);
-                firstImage = false;
-                break;
-            case Options::FORMAT_JSON_ARRAY:
-                fprintf(mapf,
-                    "%s{ \"filename\":\"%s\",\"frame\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"rotated\":%s,\"trimmed\":%s,\"spriteSourceSize\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"sourceSize\":{\"w\":%d,\"h\":%d}}\n",
-                    firstImage? " " : ",",
-                    saneFilename.c_str(),
-                    r.x, r.y, r.image->fillw, r.image->fillh,
-                    r.flipped? "true" : "false",
-                    (r.image->w!=r.image->fillw || r.image->h!=r.image->fillh)? "true" : "false",
-                    r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh,
-                    r.image->w, r.image->h);
-                firstImage = false;
-                break;
-            case Options::FORMAT_PLIST:
-               fprintf(mapf,
-                    "<key>%s</key><dict><key>frame</key><string>{{%d,%d},{%d,%d}}</string><key>offset</key><string>{%d,%d}</string><key>rotated</key><%s/><key>sourceColorRect</key><string>{{%d,%d},{%d,%d}}</string><key>sourceSize</key><string>{%d,%d}</string></dict>\n",
-                    saneFilename.c_str(),
-                    r.x, r.y, r.image->fillw, r.image->fillh,
-                    r.image->w/2-r.image->fillx, r.image->h/2-r.image->filly,
-                    r.flipped? "true" : "false",
-                    r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh,
-                    r.image->w, r.image->h);
-                break;
+    for (int p = 0; p < (int)pages.size(); ++p) {
+        const PackResult &page = pages[p];
+        std::string outImageFilename = outImageFilenames[p];
+        // Page index added to the frames of multiple page atlases
+        char pageTxt[32] = "";
+        char pageJson[32] = "";
+        char pagePlist[64] = "";
+        if (multiPage) {
+            snprintf(pageTxt, sizeof(pageTxt), " page %d", p);
+            snprintf(pageJson, sizeof(pageJson), ",\"page\":%d", p);
+            snprintf(pagePlist, sizeof(pagePlist), "<key>page</key><integer>%d</integer>", p);
+        }
+        if (options.format == Options::FORMAT_TXT) {
+            int total = (int)page.usedRects.size();
+            for (const auto &r: page.usedRects) {
+                auto it = aliases.find(r.image);
+                if (it != aliases.end()) {
+                    total += (int)it->second.size();
+                }
+            }
+            fprintf(mapf, "atlas: \"%s\" %d,%d total %d\n", filename(outImageFilename).c_str(), page.w, page.h, total);
+        }
+
+        // Build resulting atlas image
+        Image dest(page.w, page.h, 4);
+        for (const auto &used: page.usedRects) {
+            ImageAlias packed = { used.image, 0, 0, 0 };
+            std::vector<ImageAlias> frameImages(1, packed);
+            int packedFillH = used.image->fillh;
+            auto it = aliases.find(used.image);
+            if (it != aliases.end()) {
+                frameImages.insert(frameImages.end(), it->second.begin(), it->second.end());
+            }
+            for (const ImageAlias &alias: frameImages) {
+                // Aliases share the area of the packed image, with their own name, offset and source size
+                int frameFlags = FrameTransform(used.flipped, alias.transform);
+                rbp::Rect r = used;
+                r.image = alias.image;
+                // Place the part of the packed image, which has the size of the alias before its transform
+                bool transposed = (alias.transform & Image::TRANSFORM_TRANSPOSE) != 0;
+                int partH = transposed? alias.image->fillw : alias.image->fillh;
+                r.x += used.flipped? packedFillH - alias.y - partH : alias.x;
+                r.y += used.flipped? alias.x : alias.y;
+                r.flipped = (frameFlags & Image::TRANSFORM_TRANSPOSE) != 0;
+                if (r.flipped) {
+                    r.image->Rotate();
+                }
+                bool flipX = (frameFlags & Image::TRANSFORM_FLIP_X) != 0;
+                bool flipY = (frameFlags & Image::TRANSFORM_FLIP_Y) != 0;
+                char flipTxt[32] = "";
+                char flipJson[64] = "";
+                char flipPlist[96] = "";
+                if (options.dedupFlip) {
+                    snprintf(flipTxt, sizeof(flipTxt), "%s%s", flipX? " flipx" : "", flipY? " flipy" : "");
+                    snprintf(flipJson, sizeof(flipJson), ",\"flipX\":%s,\"flipY\":%s", flipX? "true" : "false", flipY? "true" : "false");
+                    snprintf(flipPlist, sizeof(flipPlist), "<key>flipX</key><%s/><key>flipY</key><%s/>", flipX? "true" : "false", flipY? "true" : "false");
+                }
+                // std::string saneFilename = ReplaceString(r.image->filename, "\\", "/");
+                std::string saneFilename = filename(r.image->filename);
+                switch (options.format) {
+                    case Options::FORMAT_TXT:
+                        fprintf(mapf, "%s: %d,%d x %d,%d offset %d,%d orgsize %d,%d %s%s%s\n",
+                            saneFilename.c_str(),
+                            r.x, r.y, r.image->fillw, r.image->fillh,
+                            r.image->fillx, r.image->filly, r.image->w, r.image->h,
+                            r.flipped? "rotated" : "original", flipTxt, pageTxt);
+                        break;
+                    case Options::FORMAT_JSON_HASH:
+                        fprintf(mapf,
+                            "%s\"%s\": { \"frame\": {\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"rotated\":%s%s,\"trimmed\":%s,\"spriteSourceSize\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"sourceSize\":{\"w\":%d,\"h\":%d}%s}\n",
+                            firstImage? " " : ",",
+                            saneFilename.c_str(),
+                            r.x, r.y, r.image->fillw, r.image->fillh,
+                            r.flipped? "true" : "false", flipJson,
+                            (r.image->w!=r.image->fillw || r.image->h!=r.image->fillh)? "true" : "false",
+                            r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh,
+                            r.image->w, r.image->h, pageJson);
+                        firstImage = false;
+                        break;
+                    case Options::FORMAT_JSON_ARRAY:
+                        fprintf(mapf,
+                            "%s{ \"filename\":\"%s\",\"frame\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"rotated\":%s%s,\"trimmed\":%s,\"spriteSourceSize\":{\"x\":%d,\"y\":%d,\"w\":%d,\"h\":%d},\"sourceSize\":{\"w\":%d,\"h\":%d}%s}\n",
+                            firstImage? " " : ",",
+                            saneFilename.c_str(),
+                            r.x, r.y, r.image->fillw, r.image->fillh,
+                            r.flipped? "true" : "false", flipJson,
+                            (r.image->w!=r.image->fillw || r.image->h!=r.image->fillh)? "true" : "false",
+                            r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh,
+                            r.image->w, r.image->h, pageJson);
+                        firstImage = false;
+                        break;
+                    case Options::FORMAT_PLIST:
+                       fprintf(mapf,
+                            "<key>%s</key><dict><key>frame</key><string>{{%d,%d},{%d,%d}}</string><key>offset</key><string>{%d,%d}</string><key>rotated</key><%s/>%s<key>sourceColorRect</key><string>{{%d,%d},{%d,%d}}</string><key>sourceSize</key><string>{%d,%d}</string>%s</dict>\n",
+                            saneFilename.c_str(),
+                            r.x, r.y, r.image->fillw, r.image->fillh,
+                            r.image->w/2-r.image->fillx, r.image->h/2-r.image->filly,
+                            r.flipped? "true" : "false", flipPlist,
+                            r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh,
+                            r.image->w, r.image->h, pagePlist);
+                        break;
+                }
+            }
+            // Images packed by their masks share the transparent parts of their areas
+            if (options.algorithm == Options::ALGORITHM_MASK) {
+                dest.BlitOpaque(*used.image, used.x, used.y, used.image->fillx, used.image->filly, used.image->fillw, used.image->fillh);
+            } else {
+                dest.Blit(*used.image, used.x, used.y, used.image->fillx, used.image->filly, used.image->fillw, used.image->fillh);
+            }
         }
-        dest.Blit(*r.image, r.x, r.y, r.image->fillx, r.image->filly, r.image->fillw, r.image->fillh);
+
+        // Save the image
+        dest.Save(outImageFilename.c_str());
     }
     switch (options.format) {
         case Options::FORMAT_TXT:
@@ -246,11 +2144,312 @@ void ImagePack(const Options &options)
             fputs("]}\n", mapf);
             break;
         case Options::FORMAT_PLIST:
-            fputs("</dict></dict></plist>\n", mapf);
+            if (multiPage) {
+                fputs("</dict><key>metadata</key><dict><key>pages</key><array>", mapf);
+                for (const auto &f: outImageFilenames) {
+                    fprintf(mapf, "<string>%s</string>", filename(f).c_str());
+                }
+                fputs("</array></dict></dict></plist>\n", mapf);
+            } else {
+                fputs("</dict></dict></plist>\n", mapf);
+            }
             break;
     }
     fclose(mapf);
+}
+
+// ------------------
+// Sparse images
+// ------------------
+
+// Images with more separate parts than this are left whole, their parts are noise rather than sprites
+static const int MAX_SPLIT_PARTS = 256;
+
+// A part of the fill area of an image, from x0,y0 to before x1,y1 in image pixels
+struct ImagePart {
+    int x0, y0, x1, y1;
+};
 
-    // Save the image
-    dest.Save(outImageFilename.c_str());
+// Area the part takes in the atlas, with its padding and rounded up to whole blocks
+long long PartArea(const Options &options, const ImagePart &part)
+{
+    int block = std::max(1, options.blockAlign);
+    long long w = (part.x1 - part.x0 + options.padx + block - 1) / block * block;
+    long long h = (part.y1 - part.y0 + options.pady + block - 1) / block * block;
+    return w*h;
+}
+
+// Bounds of the 8-connected sets of visible pixels of the image. Each row is cut into runs of visible pixels, which
+// join the runs of the row above that touch them in a union-find over the runs. Without alpha, there is one part.
+std::vector<ImagePart> FindImageParts(const Image &image)
+{
+    if (image.ncomps != 4) {
+        ImagePart whole = { image.fillx, image.filly, image.fillx + image.fillw, image.filly + image.fillh };
+        return std::vector<ImagePart>(1, whole);
+    }
+    std::vector<ImagePart> runs;
+    std::vector<int> parent;
+    auto root = [&](int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    int above = 0;
+    int aboveEnd = 0;
+    int endx = image.fillx + image.fillw;
+    for (int y = image.filly; y < image.filly + image.fillh; ++y) {
+        int rowBegin = (int)runs.size();
+        const unsigned char *ps = image.at(0, y) + 3;
+        int x = image.fillx;
+        while (x < endx) {
+            if (ps[x*4] == 0) {
+                ++x;
+                continue;
+            }
+            int x0 = x;
+            while (x < endx && ps[x*4] != 0) {
+                ++x;
+            }
+            int id = (int)runs.size();
+            ImagePart run = { x0, y, x, y + 1 };
+            runs.push_back(run);
+            parent.push_back(id);
+            // The runs of a row are in order, so the ones above that end before this one can be left behind
+            while (above < aboveEnd && runs[above].x1 < x0) {
+                ++above;
+            }
+            for (int j = above; j < aboveEnd && runs[j].x0 <= x; ++j) {
+                parent[root(j)] = root(id);
+            }
+        }
+        above = rowBegin;
+        aboveEnd = (int)runs.size();
+    }
+
+    std::vector<ImagePart> parts;
+    std::vector<int> partOf(runs.size(), -1);
+    for (int i = 0; i < (int)runs.size(); ++i) {
+        int r = root(i);
+        if (partOf[r] < 0) {
+            partOf[r] = (int)parts.size();
+            parts.push_back(runs[i]);
+        }
+        ImagePart &part = parts[partOf[r]];
+        part.x0 = std::min(part.x0, runs[i].x0);
+        part.y0 = std::min(part.y0, runs[i].y0);
+        part.x1 = std::max(part.x1, runs[i].x1);
+        part.y1 = std::max(part.y1, runs[i].y1);
+    }
+    return parts;
+}
+
+// Parts whose areas overlap are merged, or the pixels of one would be drawn again with the other, and so are parts
+// that take no more room in the atlas together than apart
+void MergeImageParts(const Options &options, std::vector<ImagePart> &parts)
+{
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < parts.size(); ++i) {
+            for (size_t j = i + 1; j < parts.size(); ++j) {
+                const ImagePart &a = parts[i];
+                const ImagePart &b = parts[j];
+                ImagePart both = { std::min(a.x0, b.x0), std::min(a.y0, b.y0), std::max(a.x1, b.x1), std::max(a.y1, b.y1) };
+                bool overlap = a.x0 < b.x1 && b.x0 < a.x1 && a.y0 < b.y1 && b.y0 < a.y1;
+                if (overlap || PartArea(options, both) <= PartArea(options, a) + PartArea(options, b)) {
+                    parts[i] = both;
+                    parts.erase(parts.begin() + j);
+                    j = i;
+                    merged = true;
+                }
+            }
+        }
+    }
+}
+
+// With -split, an image whose visible pixels are in separate parts that take less room than its fill area becomes
+// an image per part. The parts share the pixels and source size of the image, each with its own fill area, and
+// are named after it with the index of the part, from the top.
+std::vector<Image*> SplitSparseImage(const Options &options, Image *image)
+{
+    std::vector<Image*> pieces(1, image);
+    std::vector<ImagePart> parts = FindImageParts(*image);
+    if (parts.size() < 2 || (int)parts.size() > MAX_SPLIT_PARTS) {
+        return pieces;
+    }
+    MergeImageParts(options, parts);
+    ImagePart whole = { image->fillx, image->filly, image->fillx + image->fillw, image->filly + image->fillh };
+    long long area = 0;
+    for (const auto &part: parts) {
+        area += PartArea(options, part);
+    }
+    if (parts.size() < 2 || area >= PartArea(options, whole)) {
+        return pieces;
+    }
+    std::sort(parts.begin(), parts.end(), [](const ImagePart &a, const ImagePart &b) {
+        return a.y0 != b.y0? a.y0 < b.y0 : a.x0 < b.x0;
+    });
+    pieces.clear();
+    for (size_t i = 0; i < parts.size(); ++i) {
+        Image *piece = new Image(*image);
+        piece->filename = image->filename + "#" + std::to_string(i);
+        piece->fillx = parts[i].x0;
+        piece->filly = parts[i].y0;
+        piece->fillw = parts[i].x1 - parts[i].x0;
+        piece->fillh = parts[i].y1 - parts[i].y0;
+        pieces.push_back(piece);
+    }
+    return pieces;
+}
+
+// With -ba, the padding goes inside the image rects, which are rounded up to whole blocks, and the bins get none.
+// As all the sizes are then multiples of the block, every packer places the rects on block boundaries. The cells of
+// the mask algorithm are whole blocks too.
+Options BlockAlignedOptions(const Options &options)
+{
+    Options aligned = options;
+    int block = options.blockAlign;
+    if (block <= 1) {
+        return aligned;
+    }
+    aligned.padx = 0;
+    aligned.pady = 0;
+    aligned.maxw = options.maxw / block * block;
+    aligned.maxh = options.maxh / block * block;
+    while (aligned.sizeAlign % block != 0) {
+        aligned.sizeAlign += options.sizeAlign;
+    }
+    aligned.maskCell = (options.maskCell + block - 1) / block * block;
+    return aligned;
+}
+
+void ImagePack(const Options &cmdOptions)
+{
+    Options options = BlockAlignedOptions(cmdOptions);
+
+    // Load all images in parallel, splitting them with -split and hashing their pixels for -dedup as they come in,
+    // and report them in order. Pinned images are found by their names, they are not split.
+    int numFiles = (int)options.infiles.size();
+    std::vector<Image*> loaded(numFiles);
+    std::vector<std::vector<Image*> > loadedParts(numFiles);
+    std::vector<std::vector<uint64_t> > loadedHashes(numFiles);
+    ParallelFor(numFiles, [&](int i) {
+        Image *img = new Image(options.infiles[i].c_str());
+        loaded[i] = img;
+        if (!img->isLoaded()) {
+            return;
+        }
+        img->FindFillArea();
+        loadedParts[i] = options.splitSparse && !IsPinned(options, *img)? SplitSparseImage(cmdOptions, img) : std::vector<Image*>(1, img);
+        for (Image *part: loadedParts[i]) {
+            if (options.algorithm == Options::ALGORITHM_MASK) {
+                part->FindCellMask(options.maskCell, cmdOptions.padx, cmdOptions.pady);
+            }
+            loadedHashes[i].push_back(options.dedup? DedupHash(options, *part) : 0);
+        }
+    });
+    std::vector<Image*> images;
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < numFiles; ++i) {
+        Image *img = loaded[i];
+        if (!img->isLoaded()) {
+            printf("...skipping file %s\n", options.infiles[i].c_str());
+            delete img;
+            continue;
+        }
+        printf("Input file: %s (%d x %d, %d channels).", options.infiles[i].c_str(), img->w, img->h, img->ncomps);
+        printf(" Fill area is %d,%d x %d,%d\n", img->fillx, img->filly, img->fillw, img->fillh);
+        if (loadedParts[i].size() > 1) {
+            printf("...split into %d parts\n", (int)loadedParts[i].size());
+            delete img;
+        }
+        images.insert(images.end(), loadedParts[i].begin(), loadedParts[i].end());
+        hashes.insert(hashes.end(), loadedHashes[i].begin(), loadedHashes[i].end());
+    }
+    AliasMap aliases;
+    if (options.dedup) {
+        images = RemoveDuplicates(options, images, hashes, aliases);
+    }
+    if (options.dedupCrop) {
+        images = RemoveCrops(options, images, aliases);
+    }
+
+    // Images without visible pixels take no room. The packers cannot place rects without area, so these skip them
+    // and get empty frames on the first page.
+    auto firstEmpty = std::stable_partition(images.begin(), images.end(), [](const Image *i) { return i->fillw > 0 && i->fillh > 0; });
+    std::vector<Image*> emptyImages(firstEmpty, images.end());
+    images.erase(firstEmpty, images.end());
+
+    // Build array of rects corresponding to loaded images
+    std::vector<rbp::RectSize> srcRects;
+    int block = std::max(1, options.blockAlign);
+    for (auto i : images) {
+        rbp::RectSize r;
+        r.width = (i->fillw + cmdOptions.padx + block - 1) / block * block;
+        r.height = (i->fillh + cmdOptions.pady + block - 1) / block * block;
+        r.image = i;
+        srcRects.push_back(r);
+    }
+
+    if (options.benchmark) {
+        RunBenchmark(options, srcRects);
+        return;
+    }
+
+    // Same size rects are laid out on grids instead of going through the packer, unless packed by their masks
+    std::vector<PackResult> pages(1);
+    bool fits = false;
+    bool masks = options.algorithm == Options::ALGORITHM_MASK;
+    bool uniform = !masks && srcRects.size() > 1 && std::all_of(srcRects.begin(), srcRects.end(), [&](const rbp::RectSize &r) {
+        return r.width == srcRects[0].width && r.height == srcRects[0].height;
+    });
+    std::vector<rbp::RectSize> unpinnedRects;
+    std::vector<rbp::Rect> occupied;
+    if (!options.pins.empty() || !options.reserved.empty()) {
+        occupied = PinnedRects(options, srcRects, unpinnedRects);
+    }
+    if (!occupied.empty()) {
+        // Pinned images must not move, so there are no grids, compaction or order search either
+        fits = PackPinned(options, unpinnedRects, occupied, pages[0]);
+    } else if (!options.stableMap.empty() && PackStable(options, srcRects, pages)) {
+        // The kept places stay as they are, without grids, compaction or order search
+        fits = true;
+    } else if (uniform && PackUniformGrid(options, srcRects, pages[0])) {
+        fits = true;
+    } else {
+        std::vector<GridBlock> blocks;
+        std::vector<rbp::RectSize> packRects = masks? srcRects : BuildGridBlocks(options, srcRects, blocks);
+        fits = options.best? PackBest(options, packRects, pages[0]) : PackRects(options, packRects, PackSettings(options), pages[0]);
+        if (!fits) {
+            // Spill over into several pages
+            printf("Images do not fit in %d x %d, using multiple pages\n", options.maxw, options.maxh);
+            fits = PackPages(options, packRects, pages);
+        }
+        if (fits) {
+            for (auto &page: pages) {
+                CompactLayout(options, page);
+            }
+        }
+        if (fits && (options.optimizeMs > 0 || options.optimizeEvaluations > 0)) {
+            // The pages share the budgets, and each search uses all the cores
+            for (auto &page: pages) {
+                OptimizeLayout(options, options.optimizeMs / (int)pages.size(), options.optimizeEvaluations / (int)pages.size(), page);
+            }
+        }
+        for (auto &page: pages) {
+            ExpandGridBlocks(blocks, page.usedRects);
+        }
+    }
+    if (!fits) {
+        exit(1);
+    }
+    ReportOptimalityGap(options, srcRects, pages);
+
+    for (auto i : emptyImages) {
+        rbp::Rect r = { 0, 0, 0, 0, i, false };
+        pages[0].usedRects.push_back(r);
+    }
+    SaveAtlas(options, pages, aliases);
 }
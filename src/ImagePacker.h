@@ -37,6 +37,25 @@ struct Options {
         FORMAT_PLIST,
     };
 
+    enum Algorithm {
+        ALGORITHM_GUILLOTINE,
+        ALGORITHM_MAXRECTS,
+        ALGORITHM_SKYLINE,
+        ALGORITHM_SHELF,
+        ALGORITHM_MASK,
+    };
+
+    // An image placed at a fixed position of the atlas, by its file name without the path
+    struct Pin {
+        std::string name;
+        int x, y;
+    };
+
+    // An area of the atlas left empty for other content
+    struct Region {
+        int x, y, w, h;
+    };
+
     int minw;
     int minh;
     int maxw;
@@ -45,7 +64,28 @@ struct Options {
     int pady;
     bool allowFlipping;
     bool forceSquare;
+    bool best;
+    bool npot;
+    int sizeAlign;
     Format format;
+    Algorithm algorithm;
+    int heuristic;      // Free rect choice heuristic of the algorithm, -1 for its default
+    bool wasteMap;
+    bool fullRepack;
+    int optimizeMs;
+    int optimizeEvaluations;    // Orders each thread of the order search tries, 0 for no limit
+    unsigned seed;
+    bool benchmark;
+    bool dedup;
+    bool dedupFlip;     // -dedup also finds mirrored copies, and rotated ones if images can be rotated
+    bool dedupCrop;
+    std::string stableMap;  // Map file of a previous run whose places are kept
+    int stableFill;     // Percent of the atlas the stable layout must fill, or all is packed again
+    std::vector<Pin> pins;
+    std::vector<Region> reserved;
+    int blockAlign;     // Images start on and fill whole blocks of this size
+    int maskCell;       // Cell size of the masks of the mask algorithm
+    bool splitSparse;   // Images with separate visible parts are packed part by part
 
     std::vector<std::string> infiles;
     std::string outfile;
@@ -59,12 +99,33 @@ struct Options {
         pady = 1;
         allowFlipping = false;
         forceSquare = false;
+        best = false;
+        npot = false;
+        sizeAlign = 1;
         format = FORMAT_PLIST;
+        algorithm = ALGORITHM_GUILLOTINE;
+        heuristic = -1;
+        wasteMap = false;
+        fullRepack = false;
+        optimizeMs = 0;
+        optimizeEvaluations = 0;
+        seed = 1;
+        benchmark = false;
+        dedup = false;
+        dedupFlip = false;
+        dedupCrop = false;
+        stableFill = 50;
+        blockAlign = 1;
+        maskCell = 4;
+        splitSparse = false;
     }
 
     void AddInfile(const char *filename);
 };
 
+// Returns the index of the named free rect choice heuristic for the algorithm, or -1 if unknown
+int FindHeuristic(Options::Algorithm algorithm, const std::string &name);
+
 void ImagePack(const Options &options);
 
 
@@ -0,0 +1,182 @@
+/** @file MaskBinPack.cpp
+    @author Javier Arevalo
+
+    @brief Implements a bin packer that nests rectangles in the transparent parts of others.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#include <algorithm>
+
+#include "MaskBinPack.h"
+
+namespace rbp {
+
+using namespace std;
+
+/// Ors src shifted towards lower bits by n into dst: bit i of dst gets bit i+n of src.
+static void ShiftDownOr(vector<uint64_t> &dst, const vector<uint64_t> &src, int n)
+{
+    int words = (int)dst.size();
+    int q = n / 64;
+    int r = n % 64;
+    for(int j = 0; j + q < words; ++j)
+    {
+        uint64_t v = src[j + q] >> r;
+        if (r != 0 && j + q + 1 < words)
+            v |= src[j + q + 1] << (64 - r);
+        dst[j] |= v;
+    }
+}
+
+MaskBinPack::MaskBinPack()
+:cellSize(4),
+gridWords(0),
+gridRows(0)
+{
+}
+
+MaskBinPack::MaskBinPack(int width, int height)
+:cellSize(4),
+gridWords(0),
+gridRows(0)
+{
+    Init(width, height);
+}
+
+void MaskBinPack::Init(int width, int height)
+{
+    ResetBin(width, height);
+
+    gridWords = ((width + cellSize - 1) / cellSize + 63) / 64;
+    gridRows = (height + cellSize - 1) / cellSize;
+    grid.assign((size_t)gridWords*gridRows, 0);
+}
+
+void MaskBinPack::Grow(int width, int height)
+{
+    int newWords = ((width + cellSize - 1) / cellSize + 63) / 64;
+    int newRows = (height + cellSize - 1) / cellSize;
+    vector<uint64_t> newGrid((size_t)newWords*newRows, 0);
+    for(int y = 0; y < gridRows; ++y)
+        std::copy(grid.begin() + (size_t)y*gridWords, grid.begin() + (size_t)(y + 1)*gridWords, newGrid.begin() + (size_t)y*newWords);
+    grid.swap(newGrid);
+    gridWords = newWords;
+    gridRows = newRows;
+    GrowBin(width, height);
+}
+
+bool MaskBinPack::Insert(std::vector<RectSize> &rects, bool flip)
+{
+    size_t left = 0;
+    for(size_t i = 0; i < rects.size(); ++i)
+        if (Insert(rects[i], flip).height == 0)
+            rects[left++] = rects[i];
+    rects.resize(left);
+    return rects.empty();
+}
+
+Rect MaskBinPack::Insert(const RectSize &rect, bool /*flip*/)
+{
+    Rect newNode;
+    newNode.x = newNode.y = newNode.width = newNode.height = 0;
+    newNode.image = nullptr;
+    newNode.flipped = false;
+
+    // Without cells it would fit anywhere, and be recorded as used while reported as not placed
+    if (rect.width <= 0 || rect.height <= 0)
+        return newNode;
+
+    BuildRuns(rect);
+    int cellX;
+    int cellY;
+    if (!FindPosition(rect.width, rect.height, cellX, cellY))
+        return newNode;
+
+    for(size_t i = 0; i < content.size(); ++i)
+    {
+        const Run &run = content[i];
+        uint64_t *row = &grid[(size_t)(cellY + run.row)*gridWords];
+        for(int x = cellX + run.start; x < cellX + run.start + run.length; ++x)
+            row[x / 64] |= (uint64_t)1 << (x % 64);
+    }
+    newNode.x = cellX*cellSize;
+    newNode.y = cellY*cellSize;
+    newNode.width = rect.width;
+    newNode.height = rect.height;
+    newNode.image = rect.image;
+    AddUsedRectangle(newNode);
+    return newNode;
+}
+
+void MaskBinPack::BuildRuns(const RectSize &rect)
+{
+    // The cells of the mask, or all of them without a mask of this size
+    const Image *image = rect.image;
+    int cols = (rect.width + cellSize - 1) / cellSize;
+    int rows = (rect.height + cellSize - 1) / cellSize;
+    bool masked = image && image->cellSize == cellSize && image->cellCols == cols && image->cellRows == rows;
+    content.clear();
+    for(int y = 0; y < rows; ++y)
+        for(int x = 0; x < cols; ++x)
+        {
+            if (masked && !image->cellMask[y*cols + x])
+                continue;
+            if (!content.empty() && content.back().row == y && content.back().start + content.back().length == x)
+                ++content.back().length;
+            else
+            {
+                Run run = { y, x, 1 };
+                content.push_back(run);
+            }
+        }
+}
+
+void MaskBinPack::BlockRun(int gridRow, int start, int length)
+{
+    // spread gets the or of the row shifted down by 0 to length-1 bits, doubling the span at each step
+    const uint64_t *row = &grid[(size_t)gridRow*gridWords];
+    spread.assign(row, row + gridWords);
+    int span = 1;
+    while (span < length)
+    {
+        int step = min(span, length - span);
+        spreadTemp = spread;
+        ShiftDownOr(spread, spreadTemp, step);
+        span += step;
+    }
+    ShiftDownOr(blocked, spread, start);
+}
+
+bool MaskBinPack::FindPosition(int width, int height, int &cellX, int &cellY)
+{
+    if (width > binWidth || height > binHeight)
+        return false;
+    int maxX = (binWidth - width) / cellSize;
+    int maxY = (binHeight - height) / cellSize;
+    for(int y = 0; y <= maxY; ++y)
+    {
+        blocked.assign(gridWords, 0);
+        for(size_t i = 0; i < content.size(); ++i)
+            BlockRun(y + content[i].row, content[i].start, content[i].length);
+        for(int j = 0; j < gridWords && j*64 <= maxX; ++j)
+        {
+            if (~blocked[j] == 0)
+                continue;
+            int x = j*64;
+            uint64_t freeBits = ~blocked[j];
+            while (!(freeBits & 1))
+            {
+                freeBits >>= 1;
+                ++x;
+            }
+            if (x > maxX)
+                break;
+            cellX = x;
+            cellY = y;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
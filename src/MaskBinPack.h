@@ -0,0 +1,86 @@
+/** @file MaskBinPack.h
+    @author Javier Arevalo
+
+    @brief Implements a bin packer that nests rectangles in the transparent parts of others.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "BinPack.h"
+
+namespace rbp {
+
+/** MaskBinPack packs the content of the rectangles instead of their bounds. The bin is a grid of square cells,
+    and each rectangle covers the cells given by the cell mask of its image (see Image::FindCellMask), so the
+    rectangles may overlap where their images are transparent. The masks include the padding, and each rectangle
+    goes to the lowest and then leftmost cell where its mask does not cover the cells of the ones placed before.
+    Rectangles without a cell mask of their size cover all their cells. Rectangles are never rotated. */
+class MaskBinPack : public BinPack
+{
+public:
+    /// Instantiates a bin of size (0,0). Call Init to create a new bin.
+    MaskBinPack();
+
+    /// Instantiates a bin of the given size.
+    MaskBinPack(int width, int height);
+
+    /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
+    /// you need to restart with a new bin.
+    void Init(int width, int height) override;
+
+    /// Sets the size of the cells, which must match the cell masks of the images. The default is 4. Takes
+    /// effect at the next Init.
+    void SetCellSize(int size) { cellSize = size; }
+
+    /// Inserts a list of rectangles into the bin, in their order. Every one that fits is placed, the rest are
+    /// left in the list.
+    bool Insert(std::vector<RectSize> &rects, bool flip) override;
+
+    /// Inserts a single rectangle into the bin. Rotation is not supported, flip is ignored. A rectangle without
+    /// area is never placed.
+    Rect Insert(const RectSize &rect, bool flip) override;
+
+    /// Enlarges the bin, the cells of the new space are free.
+    void Grow(int width, int height) override;
+
+private:
+    /// A run of cells with content along a row of a mask.
+    struct Run
+    {
+        int row;
+        int start;
+        int length;
+    };
+
+    int cellSize;
+
+    /// Cells with content, one bit per cell. Each row has gridWords words and starts at a word.
+    std::vector<uint64_t> grid;
+    int gridWords;
+    int gridRows;
+
+    /// The cells covered by the rectangle being inserted, as runs relative to its top left cell.
+    std::vector<Run> content;
+
+    /// Scratch rows: the cells blocked for the left cell of the rectangle, and bits or'ed over a run.
+    std::vector<uint64_t> blocked;
+    std::vector<uint64_t> spread;
+    std::vector<uint64_t> spreadTemp;
+
+    /// Builds the content runs of a rectangle.
+    void BuildRuns(const RectSize &rect);
+
+    /// Finds the lowest, then leftmost, cell the rectangle fits at with the current runs.
+    /// @return True if there is one.
+    bool FindPosition(int width, int height, int &cellX, int &cellY);
+
+    /// Ors into blocked the bits of the given grid row that a run starting at start of the given length covers,
+    /// for every left cell.
+    void BlockRun(int gridRow, int start, int length);
+};
+
+}
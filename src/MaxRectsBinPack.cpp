@@ -0,0 +1,563 @@
+/** @file MaxRectsBinPack.cpp
+    @author Jukka Jylnki
+
+    Modified by Javier Arevalo. Original source: https://github.com/juj/RectangleBinPack
+
+    @brief Implements different bin packer algorithms that use the MAXRECTS data structure.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+#include <cassert>
+#include <cstdlib>
+
+#include "MaxRectsBinPack.h"
+
+namespace rbp {
+
+using namespace std;
+
+MaxRectsBinPack::MaxRectsBinPack()
+:defaultMethod(RectBestShortSideFit),
+newFreeRectanglesLastSize(0)
+{
+}
+
+MaxRectsBinPack::MaxRectsBinPack(int width, int height)
+:defaultMethod(RectBestShortSideFit),
+newFreeRectanglesLastSize(0)
+{
+    Init(width, height);
+}
+
+void MaxRectsBinPack::Init(int width, int height)
+{
+    ResetBin(width, height);
+
+    Rect n;
+    n.x = 0;
+    n.y = 0;
+    n.width = width;
+    n.height = height;
+    n.image = nullptr;
+    n.flipped = false;
+
+    freeRectangles.clear();
+    newFreeRectangles.clear();
+    freeRectangles.push_back(n);
+}
+
+bool MaxRectsBinPack::Insert(std::vector<RectSize> &rects, bool flip)
+{
+    return Insert(rects, flip, defaultMethod);
+}
+
+Rect MaxRectsBinPack::Insert(const RectSize &rect, bool flip)
+{
+    int score1;
+    int score2;
+    Rect newNode = ScoreRect(rect, flip, defaultMethod, score1, score2);
+    if (newNode.height != 0)
+        PlaceRect(newNode);
+    return newNode;
+}
+
+void MaxRectsBinPack::Grow(int width, int height)
+{
+    int oldWidth = binWidth;
+    int oldHeight = binHeight;
+    GrowBin(width, height);
+
+    // Free rectangles touching the old edges are still maximal once extended up to the new ones.
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        Rect &r = freeRectangles[i];
+        if (r.x + r.width == oldWidth)
+            r.width = width - r.x;
+        if (r.y + r.height == oldHeight)
+            r.height = height - r.y;
+    }
+
+    Rect n;
+    n.image = nullptr;
+    n.flipped = false;
+    if (width > oldWidth)
+    {
+        n.x = oldWidth;
+        n.y = 0;
+        n.width = width - oldWidth;
+        n.height = height;
+        freeRectangles.push_back(n);
+    }
+    if (height > oldHeight)
+    {
+        n.x = 0;
+        n.y = oldHeight;
+        n.width = width;
+        n.height = height - oldHeight;
+        freeRectangles.push_back(n);
+    }
+
+    // The new rectangles may cover extended ones and the other way round, prune all pairs keeping the order.
+    std::vector<char> contained(freeRectangles.size(), 0);
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+        for(size_t j = 0; j < freeRectangles.size() && !contained[i]; ++j)
+            if (i != j && !contained[j] && IsContainedIn(freeRectangles[i], freeRectangles[j]))
+                contained[i] = 1;
+    size_t count = 0;
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+        if (!contained[i])
+            freeRectangles[count++] = freeRectangles[i];
+    freeRectangles.resize(count);
+}
+
+bool MaxRectsBinPack::Insert(std::vector<RectSize> &rects, bool flip, FreeRectChoiceHeuristic method)
+{
+    BeginPending(rects.size());
+    while(pending.size() > pendingPlaced)
+    {
+        int bestScore1 = std::numeric_limits<int>::max();
+        int bestScore2 = std::numeric_limits<int>::max();
+        int bestRectIndex = -1;
+        Rect bestNode;
+
+        for(size_t i = 0; i < pending.size(); ++i)
+        {
+            if (pending[i] < 0)
+                continue;
+            int score1;
+            int score2;
+            Rect newNode = ScoreRect(rects[pending[i]], flip, method, score1, score2);
+
+            if (score1 < bestScore1 || (score1 == bestScore1 && score2 < bestScore2))
+            {
+                bestScore1 = score1;
+                bestScore2 = score2;
+                bestNode = newNode;
+                bestRectIndex = i;
+            }
+        }
+
+        if (bestRectIndex == -1)
+        {
+            EndPending(rects);
+            return false;
+        }
+
+        PlaceRect(bestNode);
+        MarkPlaced(bestRectIndex);
+    }
+    rects.clear();
+    return true;
+}
+
+void MaxRectsBinPack::PlaceRect(const Rect &node)
+{
+    for(size_t i = 0; i < freeRectangles.size();)
+    {
+        if (SplitFreeNode(freeRectangles[i], node))
+        {
+            freeRectangles[i] = freeRectangles.back();
+            freeRectangles.pop_back();
+        }
+        else
+            ++i;
+    }
+
+    PruneFreeList();
+
+    AddUsedRectangle(node);
+}
+
+Rect MaxRectsBinPack::ScoreRect(const RectSize &rect, bool flip, FreeRectChoiceHeuristic method, int &score1, int &score2) const
+{
+    Rect newNode;
+    score1 = std::numeric_limits<int>::max();
+    score2 = std::numeric_limits<int>::max();
+    switch(method)
+    {
+    case RectBestShortSideFit: newNode = FindPositionForNewNodeBestShortSideFit(rect.width, rect.height, flip, score1, score2); break;
+    case RectBottomLeftRule: newNode = FindPositionForNewNodeBottomLeft(rect.width, rect.height, flip, score1, score2); break;
+    case RectContactPointRule: newNode = FindPositionForNewNodeContactPoint(rect.width, rect.height, flip, score1);
+        score1 = -score1; // Reverse since we are minimizing, but for contact point score bigger is better.
+        break;
+    case RectBestLongSideFit: newNode = FindPositionForNewNodeBestLongSideFit(rect.width, rect.height, flip, score2, score1); break;
+    case RectBestAreaFit: newNode = FindPositionForNewNodeBestAreaFit(rect.width, rect.height, flip, score1, score2); break;
+    default: assert(false);
+    }
+
+    // Cannot fit the current rectangle.
+    if (newNode.height == 0)
+    {
+        score1 = std::numeric_limits<int>::max();
+        score2 = std::numeric_limits<int>::max();
+    }
+    newNode.image = rect.image;
+
+    return newNode;
+}
+
+/// Returns 0 if the two intervals i1 and i2 are disjoint, or the length of their overlap otherwise.
+static int CommonIntervalLength(int i1start, int i1end, int i2start, int i2end)
+{
+    if (i1end < i2start || i2end < i1start)
+        return 0;
+    return min(i1end, i2end) - max(i1start, i2start);
+}
+
+int MaxRectsBinPack::ContactPointScoreNode(int x, int y, int width, int height) const
+{
+    int score = 0;
+
+    if (x == 0 || x + width == binWidth)
+        score += height;
+    if (y == 0 || y + height == binHeight)
+        score += width;
+
+    for(size_t i = 0; i < usedRectangles.size(); ++i)
+    {
+        if (usedRectangles[i].x == x + width || usedRectangles[i].x + usedRectangles[i].width == x)
+            score += CommonIntervalLength(usedRectangles[i].y, usedRectangles[i].y + usedRectangles[i].height, y, y + height);
+        if (usedRectangles[i].y == y + height || usedRectangles[i].y + usedRectangles[i].height == y)
+            score += CommonIntervalLength(usedRectangles[i].x, usedRectangles[i].x + usedRectangles[i].width, x, x + width);
+    }
+    return score;
+}
+
+/// Builds the placed node for a free rectangle, optionally flipped.
+static Rect MakeNode(const Rect &freeRect, int width, int height, bool flipped)
+{
+    Rect node;
+    node.x = freeRect.x;
+    node.y = freeRect.y;
+    node.width = flipped? height : width;
+    node.height = flipped? width : height;
+    node.image = nullptr;
+    node.flipped = flipped;
+    return node;
+}
+
+static Rect EmptyNode()
+{
+    Rect node;
+    node.x = node.y = node.width = node.height = 0;
+    node.image = nullptr;
+    node.flipped = false;
+    return node;
+}
+
+Rect MaxRectsBinPack::FindPositionForNewNodeBottomLeft(int width, int height, bool flip, int &bestY, int &bestX) const
+{
+    Rect bestNode = EmptyNode();
+
+    bestY = std::numeric_limits<int>::max();
+    bestX = std::numeric_limits<int>::max();
+
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const Rect &freeRect = freeRectangles[i];
+        // Try to place the rectangle in upright (non-flipped) orientation.
+        if (freeRect.width >= width && freeRect.height >= height)
+        {
+            int topSideY = freeRect.y + height;
+            if (topSideY < bestY || (topSideY == bestY && freeRect.x < bestX))
+            {
+                bestNode = MakeNode(freeRect, width, height, false);
+                bestY = topSideY;
+                bestX = freeRect.x;
+            }
+        }
+        if (flip && freeRect.width >= height && freeRect.height >= width)
+        {
+            int topSideY = freeRect.y + width;
+            if (topSideY < bestY || (topSideY == bestY && freeRect.x < bestX))
+            {
+                bestNode = MakeNode(freeRect, width, height, true);
+                bestY = topSideY;
+                bestX = freeRect.x;
+            }
+        }
+    }
+    return bestNode;
+}
+
+Rect MaxRectsBinPack::FindPositionForNewNodeBestShortSideFit(int width, int height, bool flip,
+    int &bestShortSideFit, int &bestLongSideFit) const
+{
+    Rect bestNode = EmptyNode();
+
+    bestShortSideFit = std::numeric_limits<int>::max();
+    bestLongSideFit = std::numeric_limits<int>::max();
+
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const Rect &freeRect = freeRectangles[i];
+        // Try to place the rectangle in upright (non-flipped) orientation.
+        if (freeRect.width >= width && freeRect.height >= height)
+        {
+            int leftoverHoriz = abs(freeRect.width - width);
+            int leftoverVert = abs(freeRect.height - height);
+            int shortSideFit = min(leftoverHoriz, leftoverVert);
+            int longSideFit = max(leftoverHoriz, leftoverVert);
+
+            if (shortSideFit < bestShortSideFit || (shortSideFit == bestShortSideFit && longSideFit < bestLongSideFit))
+            {
+                bestNode = MakeNode(freeRect, width, height, false);
+                bestShortSideFit = shortSideFit;
+                bestLongSideFit = longSideFit;
+            }
+        }
+
+        if (flip && freeRect.width >= height && freeRect.height >= width)
+        {
+            int flippedLeftoverHoriz = abs(freeRect.width - height);
+            int flippedLeftoverVert = abs(freeRect.height - width);
+            int flippedShortSideFit = min(flippedLeftoverHoriz, flippedLeftoverVert);
+            int flippedLongSideFit = max(flippedLeftoverHoriz, flippedLeftoverVert);
+
+            if (flippedShortSideFit < bestShortSideFit || (flippedShortSideFit == bestShortSideFit && flippedLongSideFit < bestLongSideFit))
+            {
+                bestNode = MakeNode(freeRect, width, height, true);
+                bestShortSideFit = flippedShortSideFit;
+                bestLongSideFit = flippedLongSideFit;
+            }
+        }
+    }
+    return bestNode;
+}
+
+Rect MaxRectsBinPack::FindPositionForNewNodeBestLongSideFit(int width, int height, bool flip,
+    int &bestShortSideFit, int &bestLongSideFit) const
+{
+    Rect bestNode = EmptyNode();
+
+    bestShortSideFit = std::numeric_limits<int>::max();
+    bestLongSideFit = std::numeric_limits<int>::max();
+
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const Rect &freeRect = freeRectangles[i];
+        // Try to place the rectangle in upright (non-flipped) orientation.
+        if (freeRect.width >= width && freeRect.height >= height)
+        {
+            int leftoverHoriz = abs(freeRect.width - width);
+            int leftoverVert = abs(freeRect.height - height);
+            int shortSideFit = min(leftoverHoriz, leftoverVert);
+            int longSideFit = max(leftoverHoriz, leftoverVert);
+
+            if (longSideFit < bestLongSideFit || (longSideFit == bestLongSideFit && shortSideFit < bestShortSideFit))
+            {
+                bestNode = MakeNode(freeRect, width, height, false);
+                bestShortSideFit = shortSideFit;
+                bestLongSideFit = longSideFit;
+            }
+        }
+
+        if (flip && freeRect.width >= height && freeRect.height >= width)
+        {
+            int leftoverHoriz = abs(freeRect.width - height);
+            int leftoverVert = abs(freeRect.height - width);
+            int shortSideFit = min(leftoverHoriz, leftoverVert);
+            int longSideFit = max(leftoverHoriz, leftoverVert);
+
+            if (longSideFit < bestLongSideFit || (longSideFit == bestLongSideFit && shortSideFit < bestShortSideFit))
+            {
+                bestNode = MakeNode(freeRect, width, height, true);
+                bestShortSideFit = shortSideFit;
+                bestLongSideFit = longSideFit;
+            }
+        }
+    }
+    return bestNode;
+}
+
+Rect MaxRectsBinPack::FindPositionForNewNodeBestAreaFit(int width, int height, bool flip,
+    int &bestAreaFit, int &bestShortSideFit) const
+{
+    Rect bestNode = EmptyNode();
+
+    bestAreaFit = std::numeric_limits<int>::max();
+    bestShortSideFit = std::numeric_limits<int>::max();
+
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const Rect &freeRect = freeRectangles[i];
+        int areaFit = freeRect.width * freeRect.height - width * height;
+
+        // Try to place the rectangle in upright (non-flipped) orientation.
+        if (freeRect.width >= width && freeRect.height >= height)
+        {
+            int leftoverHoriz = abs(freeRect.width - width);
+            int leftoverVert = abs(freeRect.height - height);
+            int shortSideFit = min(leftoverHoriz, leftoverVert);
+
+            if (areaFit < bestAreaFit || (areaFit == bestAreaFit && shortSideFit < bestShortSideFit))
+            {
+                bestNode = MakeNode(freeRect, width, height, false);
+                bestShortSideFit = shortSideFit;
+                bestAreaFit = areaFit;
+            }
+        }
+
+        if (flip && freeRect.width >= height && freeRect.height >= width)
+        {
+            int leftoverHoriz = abs(freeRect.width - height);
+            int leftoverVert = abs(freeRect.height - width);
+            int shortSideFit = min(leftoverHoriz, leftoverVert);
+
+            if (areaFit < bestAreaFit || (areaFit == bestAreaFit && shortSideFit < bestShortSideFit))
+            {
+                bestNode = MakeNode(freeRect, width, height, true);
+                bestShortSideFit = shortSideFit;
+                bestAreaFit = areaFit;
+            }
+        }
+    }
+    return bestNode;
+}
+
+Rect MaxRectsBinPack::FindPositionForNewNodeContactPoint(int width, int height, bool flip, int &bestContactScore) const
+{
+    Rect bestNode = EmptyNode();
+
+    bestContactScore = -1;
+
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+    {
+        const Rect &freeRect = freeRectangles[i];
+        // Try to place the rectangle in upright (non-flipped) orientation.
+        if (freeRect.width >= width && freeRect.height >= height)
+        {
+            int score = ContactPointScoreNode(freeRect.x, freeRect.y, width, height);
+            if (score > bestContactScore)
+            {
+                bestNode = MakeNode(freeRect, width, height, false);
+                bestContactScore = score;
+            }
+        }
+        if (flip && freeRect.width >= height && freeRect.height >= width)
+        {
+            int score = ContactPointScoreNode(freeRect.x, freeRect.y, height, width);
+            if (score > bestContactScore)
+            {
+                bestNode = MakeNode(freeRect, width, height, true);
+                bestContactScore = score;
+            }
+        }
+    }
+    return bestNode;
+}
+
+bool MaxRectsBinPack::SplitFreeNode(const Rect &freeNode, const Rect &usedNode)
+{
+    // Test with SAT if the rectangles even intersect.
+    if (usedNode.x >= freeNode.x + freeNode.width || usedNode.x + usedNode.width <= freeNode.x ||
+        usedNode.y >= freeNode.y + freeNode.height || usedNode.y + usedNode.height <= freeNode.y)
+        return false;
+
+    // We add up to four new free rectangles to the free rectangles list below. None of these
+    // four newly added free rectangles can overlap any other three, so keep a mark of them
+    // to avoid testing them against each other.
+    newFreeRectanglesLastSize = newFreeRectangles.size();
+
+    if (usedNode.x < freeNode.x + freeNode.width && usedNode.x + usedNode.width > freeNode.x)
+    {
+        // New node at the top side of the used node.
+        if (usedNode.y > freeNode.y && usedNode.y < freeNode.y + freeNode.height)
+        {
+            Rect newNode = freeNode;
+            newNode.height = usedNode.y - newNode.y;
+            InsertNewFreeRectangle(newNode);
+        }
+
+        // New node at the bottom side of the used node.
+        if (usedNode.y + usedNode.height < freeNode.y + freeNode.height)
+        {
+            Rect newNode = freeNode;
+            newNode.y = usedNode.y + usedNode.height;
+            newNode.height = freeNode.y + freeNode.height - (usedNode.y + usedNode.height);
+            InsertNewFreeRectangle(newNode);
+        }
+    }
+
+    if (usedNode.y < freeNode.y + freeNode.height && usedNode.y + usedNode.height > freeNode.y)
+    {
+        // New node at the left side of the used node.
+        if (usedNode.x > freeNode.x && usedNode.x < freeNode.x + freeNode.width)
+        {
+            Rect newNode = freeNode;
+            newNode.width = usedNode.x - newNode.x;
+            InsertNewFreeRectangle(newNode);
+        }
+
+        // New node at the right side of the used node.
+        if (usedNode.x + usedNode.width < freeNode.x + freeNode.width)
+        {
+            Rect newNode = freeNode;
+            newNode.x = usedNode.x + usedNode.width;
+            newNode.width = freeNode.x + freeNode.width - (usedNode.x + usedNode.width);
+            InsertNewFreeRectangle(newNode);
+        }
+    }
+
+    return true;
+}
+
+void MaxRectsBinPack::InsertNewFreeRectangle(const Rect &newFreeRect)
+{
+    assert(newFreeRect.width > 0);
+    assert(newFreeRect.height > 0);
+
+    for(size_t i = 0; i < newFreeRectanglesLastSize;)
+    {
+        // This new free rectangle is already accounted for?
+        if (IsContainedIn(newFreeRect, newFreeRectangles[i]))
+            return;
+
+        // Does this new free rectangle obsolete a previous new free rectangle?
+        if (IsContainedIn(newFreeRectangles[i], newFreeRect))
+        {
+            // Remove i'th new free rectangle, but do so by retaining the order
+            // of the older vs newest free rectangles that we may still be placing
+            // in calling function SplitFreeNode().
+            newFreeRectangles[i] = newFreeRectangles[--newFreeRectanglesLastSize];
+            newFreeRectangles[newFreeRectanglesLastSize] = newFreeRectangles.back();
+            newFreeRectangles.pop_back();
+        }
+        else
+            ++i;
+    }
+    newFreeRectangles.push_back(newFreeRect);
+}
+
+void MaxRectsBinPack::PruneFreeList()
+{
+    // Test all newly introduced free rectangles against old free rectangles.
+    for(size_t i = 0; i < freeRectangles.size(); ++i)
+        for(size_t j = 0; j < newFreeRectangles.size();)
+        {
+            if (IsContainedIn(newFreeRectangles[j], freeRectangles[i]))
+            {
+                newFreeRectangles[j] = newFreeRectangles.back();
+                newFreeRectangles.pop_back();
+            }
+            else
+            {
+                // The old free rectangles can never be contained in any of the
+                // new free rectangles (the new free rectangles keep shrinking
+                // in size)
+                debug_assert(!IsContainedIn(freeRectangles[i], newFreeRectangles[j]));
+
+                ++j;
+            }
+        }
+
+    // Merge new and old free rectangles to the group of old free rectangles.
+    freeRectangles.insert(freeRectangles.end(), newFreeRectangles.begin(), newFreeRectangles.end());
+    newFreeRectangles.clear();
+}
+
+}
@@ -0,0 +1,105 @@
+/** @file MaxRectsBinPack.h
+    @author Jukka Jylnki
+
+    Modified by Javier Arevalo. Original source: https://github.com/juj/RectangleBinPack
+
+    @brief Implements different bin packer algorithms that use the MAXRECTS data structure.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#pragma once
+
+#include <vector>
+
+#include "BinPack.h"
+
+namespace rbp {
+
+/** MaxRectsBinPack implements the MAXRECTS data structure and different bin packing algorithms that
+    use this structure. The free area is tracked as a list of maximal, possibly overlapping, rectangles. */
+class MaxRectsBinPack : public BinPack
+{
+public:
+    /// Instantiates a bin of size (0,0). Call Init to create a new bin.
+    MaxRectsBinPack();
+
+    /// Instantiates a bin of the given size.
+    MaxRectsBinPack(int width, int height);
+
+    /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
+    /// you need to restart with a new bin.
+    void Init(int width, int height) override;
+
+    /// Specifies the different heuristic rules that can be used when deciding where to place a new rectangle.
+    enum FreeRectChoiceHeuristic
+    {
+        RectBestShortSideFit, ///< -BSSF: Positions the rectangle against the short side of a free rectangle into which it fits the best.
+        RectBestLongSideFit, ///< -BLSF: Positions the rectangle against the long side of a free rectangle into which it fits the best.
+        RectBestAreaFit, ///< -BAF: Positions the rectangle into the smallest free rect into which it fits.
+        RectBottomLeftRule, ///< -BL: Does the Tetris placement.
+        RectContactPointRule ///< -CP: Choosest the placement where the rectangle touches other rects as much as possible.
+    };
+
+    /// Sets the heuristic used by the BinPack interface version of Insert. The default is RectBestShortSideFit.
+    void SetHeuristic(FreeRectChoiceHeuristic method) { defaultMethod = method; }
+
+    /// Inserts a list of rectangles into the bin using the heuristic given to SetHeuristic.
+    bool Insert(std::vector<RectSize> &rects, bool flip) override;
+
+    /// Inserts a single rectangle into the bin using the heuristic given to SetHeuristic.
+    Rect Insert(const RectSize &rect, bool flip) override;
+
+    /// Enlarges the bin. Free rectangles that reach the old right or bottom edge are extended into the
+    /// new space, which also gets free rectangles of its own.
+    void Grow(int width, int height) override;
+
+    /// Inserts a list of rectangles into the bin.
+    /// @param rects The list of rectangles to add. This list will be destroyed in the packing process.
+    /// @param flip If true, Rectangles may be flipped for more optimal packing.
+    /// @param method The rectangle placement rule to use when packing.
+    /// @return true if all rectangles fit, false if a rectangle couldn't be placed
+    bool Insert(std::vector<RectSize> &rects, bool flip, FreeRectChoiceHeuristic method);
+
+    /// Returns the list of maximal free rectangles. These may overlap each other.
+    const std::vector<Rect> &GetFreeRectangles() const { return freeRectangles; }
+
+    /// Places the given rectangle into the bin at its position. The area it covers must be free.
+    void PlaceRect(const Rect &node);
+
+private:
+    FreeRectChoiceHeuristic defaultMethod;
+
+    std::vector<Rect> freeRectangles;
+
+    /// Free rectangles created by the current placement. They are only checked against the older free rectangles,
+    /// which keeps pruning linear in the size of the free list instead of quadratic.
+    std::vector<Rect> newFreeRectangles;
+    size_t newFreeRectanglesLastSize;
+
+    /// Computes the placement score for placing the given rectangle with the given method.
+    /// @param score1 [out] The primary placement score will be outputted here.
+    /// @param score2 [out] The secondary placement score will be outputted here. This isu sed to break ties.
+    /// @return This struct identifies where the rectangle would be placed if it were placed.
+    Rect ScoreRect(const RectSize &rect, bool flip, FreeRectChoiceHeuristic method, int &score1, int &score2) const;
+
+    /// Computes the placement score for the -CP variant.
+    int ContactPointScoreNode(int x, int y, int width, int height) const;
+
+    Rect FindPositionForNewNodeBottomLeft(int width, int height, bool flip, int &bestY, int &bestX) const;
+    Rect FindPositionForNewNodeBestShortSideFit(int width, int height, bool flip, int &bestShortSideFit, int &bestLongSideFit) const;
+    Rect FindPositionForNewNodeBestLongSideFit(int width, int height, bool flip, int &bestShortSideFit, int &bestLongSideFit) const;
+    Rect FindPositionForNewNodeBestAreaFit(int width, int height, bool flip, int &bestAreaFit, int &bestShortSideFit) const;
+    Rect FindPositionForNewNodeContactPoint(int width, int height, bool flip, int &contactScore) const;
+
+    /// @return True if the free node was split.
+    bool SplitFreeNode(const Rect &freeNode, const Rect &usedNode);
+
+    /// Adds a rectangle produced by SplitFreeNode, unless a sibling from the same split already contains it.
+    void InsertNewFreeRectangle(const Rect &newFreeRect);
+
+    /// Goes through the new free rectangles and removes the ones that are contained in an older one,
+    /// then moves them to the free rectangle list.
+    void PruneFreeList();
+};
+
+}
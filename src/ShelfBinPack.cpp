@@ -0,0 +1,263 @@
+/** @file ShelfBinPack.cpp
+    @author Javier Arevalo
+
+    @brief Implements a shelf bin packer for sets of rectangles with similar heights.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#include <utility>
+#include <algorithm>
+
+#include <cassert>
+
+#include "ShelfBinPack.h"
+
+namespace rbp {
+
+using namespace std;
+
+ShelfBinPack::ShelfBinPack()
+:defaultMethod(ShelfFirstFit),
+shelvesSorted(true),
+treeSize(0)
+{
+}
+
+ShelfBinPack::ShelfBinPack(int width, int height)
+:defaultMethod(ShelfFirstFit),
+shelvesSorted(true),
+treeSize(0)
+{
+    Init(width, height);
+}
+
+void ShelfBinPack::Init(int width, int height)
+{
+    ResetBin(width, height);
+
+    shelves.clear();
+    shelvesSorted = true;
+    shelvesByWidthLeft.clear();
+    std::fill(treeMax.begin(), treeMax.end(), -1);
+}
+
+bool ShelfBinPack::Insert(std::vector<RectSize> &rects, bool flip)
+{
+    return Insert(rects, flip, defaultMethod);
+}
+
+void ShelfBinPack::Grow(int width, int height)
+{
+    GrowBin(width, height);
+
+    // The width left in every shelf changed.
+    shelvesByWidthLeft.clear();
+    for(size_t i = 0; i < shelves.size(); ++i)
+        UpdateShelf(i);
+}
+
+bool ShelfBinPack::Insert(std::vector<RectSize> &rects, bool flip, ShelfChoiceHeuristic method)
+{
+    order.resize(rects.size());
+    for(size_t i = 0; i < rects.size(); ++i)
+        order[i] = i;
+    // Equal heights keep their order. Unlike std::stable_sort, this does not allocate.
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+        return rects[a].height > rects[b].height || (rects[a].height == rects[b].height && a < b);
+    });
+
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        if (Insert(rects[order[i]], flip, method).height == 0)
+        {
+            // Keep the rectangles left, in their original order.
+            pending.assign(order.begin() + i, order.end());
+            std::sort(pending.begin(), pending.end());
+            EndPending(rects);
+            return false;
+        }
+    }
+    rects.clear();
+    return true;
+}
+
+Rect ShelfBinPack::Insert(const RectSize &rect, bool flip)
+{
+    return Insert(rect, flip, defaultMethod);
+}
+
+Rect ShelfBinPack::Insert(const RectSize &rect, bool flip, ShelfChoiceHeuristic method)
+{
+    // It would open a shelf of no height, and be recorded as used while reported as not placed.
+    if (rect.width <= 0 || rect.height <= 0)
+    {
+        Rect newNode;
+        newNode.x = newNode.y = newNode.width = newNode.height = 0;
+        newNode.image = rect.image;
+        newNode.flipped = false;
+        return newNode;
+    }
+
+    // A rectangle wider than tall takes up less of the shelf standing up, if some shelf is tall enough.
+    if (flip && rect.width > rect.height)
+    {
+        int shelf = FindShelf(rect.height, rect.width, ShelfFirstFit);
+        if (shelf >= 0)
+            return PlaceOnShelf(shelf, rect.height, rect.width, rect.image, true);
+    }
+
+    int shelf = FindShelf(rect.width, rect.height, method);
+    if (shelf < 0 && rect.width <= binWidth)
+        shelf = AddShelf(rect.height);
+    // A rectangle that fits nowhere upright, like one wider than the bin, may still fit rotated.
+    if (shelf < 0 && flip)
+    {
+        shelf = FindShelf(rect.height, rect.width, method);
+        if (shelf < 0 && rect.height <= binWidth)
+            shelf = AddShelf(rect.width);
+        if (shelf >= 0)
+            return PlaceOnShelf(shelf, rect.height, rect.width, rect.image, true);
+    }
+    if (shelf < 0)
+    {
+        Rect newNode;
+        newNode.x = newNode.y = newNode.width = newNode.height = 0;
+        newNode.image = rect.image;
+        newNode.flipped = false;
+        return newNode;
+    }
+    return PlaceOnShelf(shelf, rect.width, rect.height, rect.image, false);
+}
+
+int ShelfBinPack::FindShelf(int width, int height, ShelfChoiceHeuristic method) const
+{
+    // With the shelves sorted by height, the tall enough ones come first and the search structures answer
+    // quickly. When inserting tallest first, all the shelves are tall enough.
+    if (shelvesSorted)
+    {
+        int limit = CountShelvesTallerThan(height);
+        if (method == ShelfFirstFit)
+            return FindFirstShelf(width, limit);
+        if (limit == (int)shelves.size())
+            return FindBestShelf(width);
+    }
+
+    int best = -1;
+    for(size_t i = 0; i < shelves.size(); ++i)
+    {
+        int widthLeft = binWidth - shelves[i].used;
+        if (shelves[i].height < height || widthLeft < width)
+            continue;
+        if (method == ShelfFirstFit)
+            return i;
+        if (best < 0 || widthLeft < binWidth - shelves[best].used)
+            best = i;
+    }
+    return best;
+}
+
+int ShelfBinPack::CountShelvesTallerThan(int height) const
+{
+    // Shelf heights are non-increasing, binary search the end of the tall enough ones.
+    int lo = 0;
+    int hi = (int)shelves.size();
+    while(lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (shelves[mid].height >= height)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+int ShelfBinPack::FindFirstShelf(int width, int limit) const
+{
+    if (limit <= 0 || treeSize == 0 || treeMax[1] < width)
+        return -1;
+    return FindFirstShelf(1, 0, treeSize, width, limit);
+}
+
+int ShelfBinPack::FindFirstShelf(int node, int lo, int hi, int width, int limit) const
+{
+    if (lo >= limit || treeMax[node] < width)
+        return -1;
+    if (hi - lo == 1)
+        return lo;
+    int mid = (lo + hi) / 2;
+    int found = FindFirstShelf(2*node, lo, mid, width, limit);
+    if (found >= 0)
+        return found;
+    return FindFirstShelf(2*node+1, mid, hi, width, limit);
+}
+
+int ShelfBinPack::FindBestShelf(int width) const
+{
+    auto it = shelvesByWidthLeft.lower_bound(std::make_pair(width, -1));
+    return (it == shelvesByWidthLeft.end())? -1 : it->second;
+}
+
+int ShelfBinPack::AddShelf(int height)
+{
+    int y = shelves.empty()? 0 : shelves.back().y + shelves.back().height;
+    if (y + height > binHeight)
+        return -1;
+
+    if (!shelves.empty() && height > shelves.back().height)
+        shelvesSorted = false;
+
+    Shelf shelf;
+    shelf.y = y;
+    shelf.height = height;
+    shelf.used = 0;
+    shelves.push_back(shelf);
+
+    // Grow the search tree when it runs out of leaves.
+    int index = (int)shelves.size() - 1;
+    if (index >= treeSize)
+    {
+        treeSize = std::max(64, treeSize * 2);
+        treeMax.assign(2 * treeSize, -1);
+        for(int i = 0; i < index; ++i)
+            treeMax[treeSize + i] = binWidth - shelves[i].used;
+        for(int i = treeSize - 1; i > 0; --i)
+            treeMax[i] = max(treeMax[2*i], treeMax[2*i+1]);
+    }
+    UpdateShelf(index);
+    return index;
+}
+
+Rect ShelfBinPack::PlaceOnShelf(int shelfIndex, int width, int height, Image *image, bool flipped)
+{
+    Shelf &shelf = shelves[shelfIndex];
+    assert(shelf.used + width <= binWidth && height <= shelf.height);
+
+    Rect newNode;
+    newNode.x = shelf.used;
+    newNode.y = shelf.y;
+    newNode.width = width;
+    newNode.height = height;
+    newNode.image = image;
+    newNode.flipped = flipped;
+
+    shelvesByWidthLeft.erase(std::make_pair(binWidth - shelf.used, shelfIndex));
+    shelf.used += width;
+    UpdateShelf(shelfIndex);
+
+    AddUsedRectangle(newNode);
+    return newNode;
+}
+
+void ShelfBinPack::UpdateShelf(int shelfIndex)
+{
+    int widthLeft = binWidth - shelves[shelfIndex].used;
+    shelvesByWidthLeft.insert(std::make_pair(widthLeft, shelfIndex));
+
+    int node = treeSize + shelfIndex;
+    treeMax[node] = widthLeft;
+    for(node /= 2; node > 0; node /= 2)
+        treeMax[node] = max(treeMax[2*node], treeMax[2*node+1]);
+}
+
+}
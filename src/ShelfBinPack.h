@@ -0,0 +1,122 @@
+/** @file ShelfBinPack.h
+    @author Javier Arevalo
+
+    @brief Implements a shelf bin packer for sets of rectangles with similar heights.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#pragma once
+
+#include <vector>
+#include <set>
+#include <utility>
+
+#include "BinPack.h"
+
+namespace rbp {
+
+/** ShelfBinPack sorts the rectangles by decreasing height and places them left to right on horizontal shelves.
+    A new shelf is opened on top of the previous one when a rectangle does not fit in any existing shelf. Shelf
+    selection is logarithmic in the number of shelves, so a full Insert takes O(n log n) time. This is close
+    to optimal for font glyphs and icons, which have nearly the same height. */
+class ShelfBinPack : public BinPack
+{
+public:
+    /// Instantiates a bin of size (0,0). Call Init to create a new bin.
+    ShelfBinPack();
+
+    /// Instantiates a bin of the given size.
+    ShelfBinPack(int width, int height);
+
+    /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
+    /// you need to restart with a new bin.
+    void Init(int width, int height) override;
+
+    /// Defines the rules that decide which existing shelf receives a rectangle.
+    enum ShelfChoiceHeuristic
+    {
+        ShelfFirstFit, ///< -FF: The lowest shelf with enough room left.
+        ShelfBestFit ///< -BF: The shelf that will have the least room left after placing the rectangle.
+    };
+
+    /// Sets the heuristic used by the BinPack interface version of Insert. The default is ShelfFirstFit.
+    void SetHeuristic(ShelfChoiceHeuristic method) { defaultMethod = method; }
+
+    /// Inserts a list of rectangles into the bin using the heuristic given to SetHeuristic.
+    bool Insert(std::vector<RectSize> &rects, bool flip) override;
+
+    /// Inserts a single rectangle into the bin using the heuristic given to SetHeuristic.
+    Rect Insert(const RectSize &rect, bool flip) override;
+
+    /// Enlarges the bin. Every shelf gets the added width, and new shelves can open in the added height.
+    void Grow(int width, int height) override;
+
+    /// Inserts a list of rectangles into the bin. They are sorted by decreasing height first; equal heights
+    /// keep their order.
+    /// @param rects The list of rectangles to add. Placed rectangles are removed from it, the ones left
+    ///        keep their order.
+    /// @param flip If true, a rectangle may be rotated to stand inside a shelf tall enough, where it
+    ///        takes up less width.
+    /// @param method The shelf choice rule to use.
+    /// @return true if all rectangles fit, false if a rectangle couldn't be placed
+    bool Insert(std::vector<RectSize> &rects, bool flip, ShelfChoiceHeuristic method);
+
+    /// Inserts a single rectangle into the bin. Rectangles taller than the shelves below them make
+    /// later searches linear in the number of shelves. A rectangle without area is never placed.
+    /// @return The placed rectangle, with height 0 if it did not fit.
+    Rect Insert(const RectSize &rect, bool flip, ShelfChoiceHeuristic method);
+
+private:
+    struct Shelf
+    {
+        /// The y-coordinate of the bottom of the shelf.
+        int y;
+
+        /// Height of the shelf, set by the first rectangle placed on it.
+        int height;
+
+        /// Width used so far, which is where the next rectangle goes.
+        int used;
+    };
+
+    ShelfChoiceHeuristic defaultMethod;
+
+    /// Shelves from the bottom of the bin up. Their heights never increase while rectangles are inserted
+    /// tallest first, which shelvesSorted tells.
+    std::vector<Shelf> shelves;
+    bool shelvesSorted;
+
+    /// Tree of the maximum width left in the shelves, leaves start at treeSize. Used for first fit searches.
+    std::vector<int> treeMax;
+    int treeSize;
+
+    /// Width left and index of every shelf, sorted. Used for best fit searches.
+    std::set<std::pair<int, int> > shelvesByWidthLeft;
+
+    /// Orders the rectangles by decreasing height.
+    std::vector<int> order;
+
+    /// Returns the number of shelves at least height units tall, they are the first ones.
+    int CountShelvesTallerThan(int height) const;
+
+    /// Returns the lowest of the first 'limit' shelves with at least width units left, or -1.
+    int FindFirstShelf(int width, int limit) const;
+    int FindFirstShelf(int node, int lo, int hi, int width, int limit) const;
+
+    /// Returns the shelf with the least room left that still has width units, or -1.
+    int FindBestShelf(int width) const;
+
+    /// Returns a shelf at least height units tall with width units left, chosen by the given rule, or -1.
+    int FindShelf(int width, int height, ShelfChoiceHeuristic method) const;
+
+    /// Opens a new shelf on top of the others. Returns its index or -1 if it does not fit in the bin.
+    int AddShelf(int height);
+
+    /// Places a rectangle of the given final size on a shelf.
+    Rect PlaceOnShelf(int shelfIndex, int width, int height, Image *image, bool flipped);
+
+    /// Stores the width left in a shelf into the search structures.
+    void UpdateShelf(int shelfIndex);
+};
+
+}
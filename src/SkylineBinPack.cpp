@@ -0,0 +1,372 @@
+/** @file SkylineBinPack.cpp
+    @author Jukka Jylnki
+
+    Modified by Javier Arevalo. Original source: https://github.com/juj/RectangleBinPack
+
+    @brief Implements different bin packer algorithms that use the SKYLINE data structure.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+#include <cassert>
+
+#include "SkylineBinPack.h"
+
+namespace rbp {
+
+using namespace std;
+
+SkylineBinPack::SkylineBinPack()
+:defaultMethod(LevelBottomLeft),
+defaultUseWasteMap(false),
+useWasteMap(false)
+{
+}
+
+SkylineBinPack::SkylineBinPack(int width, int height, bool useWasteMap)
+:defaultMethod(LevelBottomLeft),
+defaultUseWasteMap(useWasteMap)
+{
+    Init(width, height, useWasteMap);
+}
+
+void SkylineBinPack::Init(int width, int height)
+{
+    Init(width, height, defaultUseWasteMap);
+}
+
+void SkylineBinPack::Init(int width, int height, bool useWasteMap_)
+{
+    ResetBin(width, height);
+    useWasteMap = useWasteMap_;
+
+    skyLine.clear();
+    SkylineNode node;
+    node.x = 0;
+    node.y = 0;
+    node.width = binWidth;
+    skyLine.push_back(node);
+
+    if (useWasteMap)
+    {
+        wasteMap.Init(width, height);
+        wasteMap.GetFreeRectangles().clear();
+    }
+}
+
+bool SkylineBinPack::Insert(std::vector<RectSize> &rects, bool flip)
+{
+    return Insert(rects, flip, defaultMethod);
+}
+
+Rect SkylineBinPack::Insert(const RectSize &rect, bool flip)
+{
+    return Insert(rect, flip, defaultMethod);
+}
+
+void SkylineBinPack::Grow(int width, int height)
+{
+    if (width > binWidth)
+    {
+        SkylineNode node;
+        node.x = binWidth;
+        node.y = 0;
+        node.width = width - binWidth;
+        skyLine.push_back(node);
+        MergeSkylines();
+    }
+    // The waste map only tracks the holes under the skyline, the new space does not go there.
+    GrowBin(width, height);
+}
+
+bool SkylineBinPack::Insert(std::vector<RectSize> &rects, bool flip, LevelChoiceHeuristic method)
+{
+    for(size_t i = 0; i < rects.size(); ++i)
+    {
+        Rect newNode = Insert(rects[i], flip, method);
+        if (newNode.height == 0)
+        {
+            rects.erase(rects.begin(), rects.begin() + i);
+            return false;
+        }
+    }
+    rects.clear();
+    return true;
+}
+
+Rect SkylineBinPack::Insert(const RectSize &rect, bool flip, LevelChoiceHeuristic method)
+{
+    Rect newNode;
+    newNode.height = 0;
+
+    // The skyline would get a level of no height for it, and still report it as not placed.
+    if (rect.width <= 0 || rect.height <= 0)
+        return newNode;
+
+    // First try to pack this rectangle into the waste map, if it fits.
+    if (useWasteMap)
+        newNode = wasteMap.Insert(rect.width, rect.height, true, flip, GuillotineBinPack::RectBestShortSideFit,
+            GuillotineBinPack::SplitMaximizeArea);
+
+    if (newNode.height == 0)
+    {
+        switch(method)
+        {
+        case LevelBottomLeft: newNode = InsertBottomLeft(rect.width, rect.height, flip); break;
+        case LevelMinWasteFit: newNode = InsertMinWaste(rect.width, rect.height, flip); break;
+        default: assert(false); return newNode;
+        }
+        if (newNode.height == 0)
+            return newNode;
+    }
+
+    newNode.image = rect.image;
+    AddUsedRectangle(newNode);
+    return newNode;
+}
+
+bool SkylineBinPack::RectangleFits(int skylineNodeIndex, int width, int height, int &y) const
+{
+    int x = skyLine[skylineNodeIndex].x;
+    if (x + width > binWidth)
+        return false;
+    int widthLeft = width;
+    int i = skylineNodeIndex;
+    y = skyLine[skylineNodeIndex].y;
+    while(widthLeft > 0)
+    {
+        y = max(y, skyLine[i].y);
+        if (y + height > binHeight)
+            return false;
+        widthLeft -= skyLine[i].width;
+        ++i;
+        assert(i < (int)skyLine.size() || widthLeft <= 0);
+    }
+    return true;
+}
+
+int SkylineBinPack::ComputeWastedArea(int skylineNodeIndex, int width, int height, int y) const
+{
+    int wastedArea = 0;
+    const int rectLeft = skyLine[skylineNodeIndex].x;
+    const int rectRight = rectLeft + width;
+    for(; skylineNodeIndex < (int)skyLine.size() && skyLine[skylineNodeIndex].x < rectRight; ++skylineNodeIndex)
+    {
+        if (skyLine[skylineNodeIndex].x >= rectRight || skyLine[skylineNodeIndex].x + skyLine[skylineNodeIndex].width <= rectLeft)
+            break;
+
+        int leftSide = skyLine[skylineNodeIndex].x;
+        int rightSide = min(rectRight, leftSide + skyLine[skylineNodeIndex].width);
+        assert(y >= skyLine[skylineNodeIndex].y);
+        wastedArea += (rightSide - leftSide) * (y - skyLine[skylineNodeIndex].y);
+    }
+    return wastedArea;
+}
+
+bool SkylineBinPack::RectangleFits(int skylineNodeIndex, int width, int height, int &y, int &wastedArea) const
+{
+    bool fits = RectangleFits(skylineNodeIndex, width, height, y);
+    if (fits)
+        wastedArea = ComputeWastedArea(skylineNodeIndex, width, height, y);
+
+    return fits;
+}
+
+void SkylineBinPack::AddWasteMapArea(int skylineNodeIndex, int width, int height, int y)
+{
+    const int rectLeft = skyLine[skylineNodeIndex].x;
+    const int rectRight = rectLeft + width;
+    for(; skylineNodeIndex < (int)skyLine.size() && skyLine[skylineNodeIndex].x < rectRight; ++skylineNodeIndex)
+    {
+        if (skyLine[skylineNodeIndex].x >= rectRight || skyLine[skylineNodeIndex].x + skyLine[skylineNodeIndex].width <= rectLeft)
+            break;
+
+        int leftSide = skyLine[skylineNodeIndex].x;
+        int rightSide = min(rectRight, leftSide + skyLine[skylineNodeIndex].width);
+        assert(y >= skyLine[skylineNodeIndex].y);
+
+        Rect waste;
+        waste.x = leftSide;
+        waste.y = skyLine[skylineNodeIndex].y;
+        waste.width = rightSide - leftSide;
+        waste.height = y - skyLine[skylineNodeIndex].y;
+
+        if (waste.width > 0 && waste.height > 0)
+            wasteMap.GetFreeRectangles().push_back(waste);
+    }
+}
+
+void SkylineBinPack::AddSkylineLevel(int skylineNodeIndex, const Rect &rect)
+{
+    // First track all wasted areas and mark them into the waste map if we're using one.
+    if (useWasteMap)
+        AddWasteMapArea(skylineNodeIndex, rect.width, rect.height, rect.y);
+
+    SkylineNode newNode;
+    newNode.x = rect.x;
+    newNode.y = rect.y + rect.height;
+    newNode.width = rect.width;
+    skyLine.insert(skyLine.begin() + skylineNodeIndex, newNode);
+
+    assert(newNode.x + newNode.width <= binWidth);
+    assert(newNode.y <= binHeight);
+
+    for(size_t i = skylineNodeIndex+1; i < skyLine.size(); ++i)
+    {
+        assert(skyLine[i-1].x <= skyLine[i].x);
+
+        if (skyLine[i].x < skyLine[i-1].x + skyLine[i-1].width)
+        {
+            int shrink = skyLine[i-1].x + skyLine[i-1].width - skyLine[i].x;
+
+            skyLine[i].x += shrink;
+            skyLine[i].width -= shrink;
+
+            if (skyLine[i].width <= 0)
+            {
+                skyLine.erase(skyLine.begin() + i);
+                --i;
+            }
+            else
+                break;
+        }
+        else
+            break;
+    }
+    MergeSkylines();
+}
+
+void SkylineBinPack::MergeSkylines()
+{
+    for(size_t i = 0; i < skyLine.size()-1; ++i)
+        if (skyLine[i].y == skyLine[i+1].y)
+        {
+            skyLine[i].width += skyLine[i+1].width;
+            skyLine.erase(skyLine.begin() + (i+1));
+            --i;
+        }
+}
+
+Rect SkylineBinPack::InsertBottomLeft(int width, int height, bool flip)
+{
+    int bestHeight;
+    int bestWidth;
+    int bestIndex;
+    Rect newNode = FindPositionForNewNodeBottomLeft(width, height, flip, bestHeight, bestWidth, bestIndex);
+
+    if (bestIndex != -1)
+        AddSkylineLevel(bestIndex, newNode);
+
+    return newNode;
+}
+
+Rect SkylineBinPack::FindPositionForNewNodeBottomLeft(int width, int height, bool flip, int &bestHeight, int &bestWidth, int &bestIndex) const
+{
+    bestHeight = std::numeric_limits<int>::max();
+    bestIndex = -1;
+    // Used to break ties if there are nodes at the same level. Then pick the narrowest one.
+    bestWidth = std::numeric_limits<int>::max();
+    Rect newNode;
+    newNode.x = newNode.y = newNode.width = newNode.height = 0;
+    newNode.image = nullptr;
+    newNode.flipped = false;
+    for(size_t i = 0; i < skyLine.size(); ++i)
+    {
+        int y;
+        if (RectangleFits(i, width, height, y))
+        {
+            if (y + height < bestHeight || (y + height == bestHeight && skyLine[i].width < bestWidth))
+            {
+                bestHeight = y + height;
+                bestIndex = i;
+                bestWidth = skyLine[i].width;
+                newNode.x = skyLine[i].x;
+                newNode.y = y;
+                newNode.width = width;
+                newNode.height = height;
+                newNode.flipped = false;
+            }
+        }
+        if (flip && RectangleFits(i, height, width, y))
+        {
+            if (y + width < bestHeight || (y + width == bestHeight && skyLine[i].width < bestWidth))
+            {
+                bestHeight = y + width;
+                bestIndex = i;
+                bestWidth = skyLine[i].width;
+                newNode.x = skyLine[i].x;
+                newNode.y = y;
+                newNode.width = height;
+                newNode.height = width;
+                newNode.flipped = true;
+            }
+        }
+    }
+
+    return newNode;
+}
+
+Rect SkylineBinPack::InsertMinWaste(int width, int height, bool flip)
+{
+    int bestHeight;
+    int bestWastedArea;
+    int bestIndex;
+    Rect newNode = FindPositionForNewNodeMinWaste(width, height, flip, bestHeight, bestWastedArea, bestIndex);
+
+    if (bestIndex != -1)
+        AddSkylineLevel(bestIndex, newNode);
+
+    return newNode;
+}
+
+Rect SkylineBinPack::FindPositionForNewNodeMinWaste(int width, int height, bool flip, int &bestHeight, int &bestWastedArea, int &bestIndex) const
+{
+    bestHeight = std::numeric_limits<int>::max();
+    bestWastedArea = std::numeric_limits<int>::max();
+    bestIndex = -1;
+    Rect newNode;
+    newNode.x = newNode.y = newNode.width = newNode.height = 0;
+    newNode.image = nullptr;
+    newNode.flipped = false;
+    for(size_t i = 0; i < skyLine.size(); ++i)
+    {
+        int y;
+        int wastedArea;
+
+        if (RectangleFits(i, width, height, y, wastedArea))
+        {
+            if (wastedArea < bestWastedArea || (wastedArea == bestWastedArea && y + height < bestHeight))
+            {
+                bestHeight = y + height;
+                bestWastedArea = wastedArea;
+                bestIndex = i;
+                newNode.x = skyLine[i].x;
+                newNode.y = y;
+                newNode.width = width;
+                newNode.height = height;
+                newNode.flipped = false;
+            }
+        }
+        if (flip && RectangleFits(i, height, width, y, wastedArea))
+        {
+            if (wastedArea < bestWastedArea || (wastedArea == bestWastedArea && y + width < bestHeight))
+            {
+                bestHeight = y + width;
+                bestWastedArea = wastedArea;
+                bestIndex = i;
+                newNode.x = skyLine[i].x;
+                newNode.y = y;
+                newNode.width = height;
+                newNode.height = width;
+                newNode.flipped = true;
+            }
+        }
+    }
+
+    return newNode;
+}
+
+}
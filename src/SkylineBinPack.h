@@ -0,0 +1,113 @@
+/** @file SkylineBinPack.h
+    @author Jukka Jylnki
+
+    Modified by Javier Arevalo. Original source: https://github.com/juj/RectangleBinPack
+
+    @brief Implements different bin packer algorithms that use the SKYLINE data structure.
+
+    This work is released to Public Domain, do whatever you want with it.
+*/
+#pragma once
+
+#include <vector>
+
+#include "BinPack.h"
+#include "GuillotineBinPack.h"
+
+namespace rbp {
+
+/** Implements bin packing algorithms that use the SKYLINE data structure to store the bin contents. Uses
+    GuillotineBinPack as the waste map. The cost of placing a rectangle grows with the length of the skyline,
+    not with the number of free rectangles, which makes it the fastest of the packers. */
+class SkylineBinPack : public BinPack
+{
+public:
+    /// Instantiates a bin of size (0,0). Call Init to create a new bin.
+    SkylineBinPack();
+
+    /// Instantiates a bin of the given size.
+    SkylineBinPack(int binWidth, int binHeight, bool useWasteMap);
+
+    /// (Re)initializes the packer to an empty bin of width x height units. Call whenever
+    /// you need to restart with a new bin.
+    void Init(int width, int height) override;
+
+    /// (Re)initializes the packer, optionally enabling the waste map.
+    void Init(int width, int height, bool useWasteMap);
+
+    /// Defines the different heuristic rules that can be used to decide how to make the rectangle placements.
+    enum LevelChoiceHeuristic
+    {
+        LevelBottomLeft,
+        LevelMinWasteFit
+    };
+
+    /// Sets the heuristic used by the BinPack interface version of Insert. The default is LevelBottomLeft.
+    void SetHeuristic(LevelChoiceHeuristic method) { defaultMethod = method; }
+
+    /// Sets whether Init enables the waste map. The space wasted under the skyline is tracked with a
+    /// GuillotineBinPack and tried first for every rectangle. Disabled by default.
+    void SetUseWasteMap(bool enable) { defaultUseWasteMap = enable; }
+
+    /// Inserts a list of rectangles into the bin, in the given order, using the heuristic given to SetHeuristic.
+    bool Insert(std::vector<RectSize> &rects, bool flip) override;
+
+    /// Inserts a single rectangle into the bin using the heuristic given to SetHeuristic.
+    Rect Insert(const RectSize &rect, bool flip) override;
+
+    /// Enlarges the bin. The skyline gets a new level at the bottom of the space added to the right.
+    void Grow(int width, int height) override;
+
+    /// Inserts a list of rectangles into the bin, in the given order. Sort them before calling, for example
+    /// by decreasing height, for best results.
+    /// @param rects The list of rectangles to add. Placed rectangles are removed from it.
+    /// @param flip If true, Rectangles may be flipped for more optimal packing.
+    /// @param method The rectangle placement rule to use when packing.
+    /// @return true if all rectangles fit, false if a rectangle couldn't be placed
+    bool Insert(std::vector<RectSize> &rects, bool flip, LevelChoiceHeuristic method);
+
+    /// Inserts a single rectangle into the bin. A rectangle without area is never placed.
+    /// @return The placed rectangle, with height 0 if it did not fit.
+    Rect Insert(const RectSize &rect, bool flip, LevelChoiceHeuristic method);
+
+private:
+    /// Represents a single level (a horizontal line) of the skyline/horizon/envelope.
+    struct SkylineNode
+    {
+        /// The starting x-coordinate (leftmost).
+        int x;
+
+        /// The y-coordinate of the skyline level line.
+        int y;
+
+        /// The line width. The ending coordinate (inclusive) will be x+width-1.
+        int width;
+    };
+
+    LevelChoiceHeuristic defaultMethod;
+    bool defaultUseWasteMap;
+
+    std::vector<SkylineNode> skyLine;
+
+    bool useWasteMap;
+    GuillotineBinPack wasteMap;
+
+    Rect InsertBottomLeft(int width, int height, bool flip);
+    Rect InsertMinWaste(int width, int height, bool flip);
+
+    Rect FindPositionForNewNodeMinWaste(int width, int height, bool flip, int &bestHeight, int &bestWastedArea, int &bestIndex) const;
+    Rect FindPositionForNewNodeBottomLeft(int width, int height, bool flip, int &bestHeight, int &bestWidth, int &bestIndex) const;
+
+    bool RectangleFits(int skylineNodeIndex, int width, int height, int &y) const;
+    bool RectangleFits(int skylineNodeIndex, int width, int height, int &y, int &wastedArea) const;
+    int ComputeWastedArea(int skylineNodeIndex, int width, int height, int y) const;
+
+    void AddWasteMapArea(int skylineNodeIndex, int width, int height, int y);
+
+    void AddSkylineLevel(int skylineNodeIndex, const Rect &rect);
+
+    /// Merges all skyline nodes that are at the same level.
+    void MergeSkylines();
+};
+
+}
@@ -45,8 +45,35 @@ void help(FILE *out) {
         "    -fmt, --map-format    format      Format of the map file [plist]\n"
         "    -rot, --allow-rotate              Images can be rotated 90 deg\n"
         "    -sq, --force-square               Output must be square\n"
-        "  Valid formats: plist, json-array, json-hash, txt"
-        "\n"
+        "    -best, --best                     Try all packing heuristics, keep the smallest\n"
+        "    -npot, --npot                     Output size need not be a power of 2\n"
+        "    -sa, --size-align     number      Non power of 2 sizes are multiples of this [1]\n"
+        "    -alg, --algorithm     algorithm   Packing algorithm [guillotine]\n"
+        "    -heur, --heuristic    heuristic   Free rect choice heuristic of the algorithm\n"
+        "    -wm, --waste-map                  Skyline reuses the space wasted under the skyline\n"
+        "    -fast, --fast                     Fast packing for iteration, same as -alg skyline\n"
+        "    -repack, --full-repack            Repack all images at each bigger size, instead of growing\n"
+        "    -opt, --optimize-ms   number      Search image orders for a smaller atlas for this long [0]\n"
+        "    -opte, --optimize-evals number    Search image orders for a smaller atlas for this many tries per core [0]\n"
+        "    -seed, --seed         number      Random seed of the order search [1]\n"
+        "    -bench, --benchmark               Time all the packers on the input, no output\n"
+        "    -dedup, --dedup                   Pack identical images once, their frames share the area\n"
+        "    -dedupflip, --dedup-flip          Like -dedup, also for mirrored copies and, with -rot, rotated ones\n"
+        "    -dedupcrop, --dedup-crop          Images found inside a bigger image use its area\n"
+        "    -stable, --stable-layout filename Keep images where this previous map file placed them\n"
+        "    -sfill, --stable-fill number      Pack all again if the stable layout fills less percent [50]\n"
+        "    -pin, --pin           name:x,y    Place the image with this file name at x,y\n"
+        "    -reserve, --reserve   x,y,w,h     Leave this area of the atlas empty\n"
+        "    -ba, --block-align    number      Images start on and fill whole blocks of this size [1]\n"
+        "    -cell, --mask-cell    number      Cell size of the masks of the mask algorithm [4]\n"
+        "    -split, --split-sparse            Pack the separate visible parts of images as frames of their own\n"
+        "  Valid formats: plist, json-array, json-hash, txt\n"
+        "  Valid algorithms and heuristics:\n"
+        "    guillotine: bssf (default), baf, blsf, waf, wssf, wlsf\n"
+        "    maxrects: bssf (default), blsf, baf, bl, cp\n"
+        "    skyline: bl (default), minwaste\n"
+        "    shelf: firstfit (default), bestfit\n"
+        "    mask: no heuristics\n"
 	, out);
 }
 
@@ -81,6 +108,7 @@ int main(int argc, char* argv[])
     }
 
     Options options;
+    std::string heuristic;
 
     for (int i = 1; i < argc; ++i) {
         // If it's not an option then it is an input file
@@ -104,7 +132,7 @@ int main(int argc, char* argv[])
                 options.maxw = atoi(FindParam(argc, argv, arg, i, paramStr));
             } else if (arg.compare("-minh") == 0 || arg.compare("--min-height") == 0) {
                 options.minh = atoi(FindParam(argc, argv, arg, i, paramStr));
-            } else if (arg.compare("-max") == 0 || arg.compare("--max-height") == 0) {
+            } else if (arg.compare("-maxh") == 0 || arg.compare("--max-height") == 0) {
                 options.maxh = atoi(FindParam(argc, argv, arg, i, paramStr));
             } else if (arg.compare("-o") == 0 || arg.compare("--output-filename") == 0) {
                 const char *param = FindParam(argc, argv, arg, i, paramStr);
@@ -129,6 +157,80 @@ int main(int argc, char* argv[])
                 options.allowFlipping = true;
             } else if (arg.compare("-sq") == 0 || arg.compare("--force-square") == 0) {
                 options.forceSquare = true;
+            } else if (arg.compare("-best") == 0 || arg.compare("--best") == 0) {
+                options.best = true;
+            } else if (arg.compare("-npot") == 0 || arg.compare("--npot") == 0) {
+                options.npot = true;
+            } else if (arg.compare("-sa") == 0 || arg.compare("--size-align") == 0) {
+                options.sizeAlign = atoi(FindParam(argc, argv, arg, i, paramStr));
+                if (options.sizeAlign < 1) {
+                    error("Invalid size alignment: %d", options.sizeAlign);
+                }
+            } else if (arg.compare("-alg") == 0 || arg.compare("--algorithm") == 0) {
+                std::string alg = FindParam(argc, argv, arg, i, paramStr);
+                if (alg.compare("guillotine") == 0) options.algorithm = Options::ALGORITHM_GUILLOTINE;
+                else if (alg.compare("maxrects") == 0) options.algorithm = Options::ALGORITHM_MAXRECTS;
+                else if (alg.compare("skyline") == 0) options.algorithm = Options::ALGORITHM_SKYLINE;
+                else if (alg.compare("shelf") == 0) options.algorithm = Options::ALGORITHM_SHELF;
+                else if (alg.compare("mask") == 0) options.algorithm = Options::ALGORITHM_MASK;
+                else {
+                    error("Unrecognized algorithm: %s", alg.c_str());
+                }
+            } else if (arg.compare("-heur") == 0 || arg.compare("--heuristic") == 0) {
+                heuristic = FindParam(argc, argv, arg, i, paramStr);
+            } else if (arg.compare("-wm") == 0 || arg.compare("--waste-map") == 0) {
+                options.wasteMap = true;
+            } else if (arg.compare("-fast") == 0 || arg.compare("--fast") == 0) {
+                options.algorithm = Options::ALGORITHM_SKYLINE;
+            } else if (arg.compare("-repack") == 0 || arg.compare("--full-repack") == 0) {
+                options.fullRepack = true;
+            } else if (arg.compare("-opt") == 0 || arg.compare("--optimize-ms") == 0) {
+                options.optimizeMs = atoi(FindParam(argc, argv, arg, i, paramStr));
+            } else if (arg.compare("-opte") == 0 || arg.compare("--optimize-evals") == 0) {
+                options.optimizeEvaluations = atoi(FindParam(argc, argv, arg, i, paramStr));
+            } else if (arg.compare("-seed") == 0 || arg.compare("--seed") == 0) {
+                options.seed = (unsigned)strtoul(FindParam(argc, argv, arg, i, paramStr), nullptr, 10);
+            } else if (arg.compare("-bench") == 0 || arg.compare("--benchmark") == 0) {
+                options.benchmark = true;
+            } else if (arg.compare("-dedup") == 0 || arg.compare("--dedup") == 0) {
+                options.dedup = true;
+            } else if (arg.compare("-dedupflip") == 0 || arg.compare("--dedup-flip") == 0) {
+                options.dedup = true;
+                options.dedupFlip = true;
+            } else if (arg.compare("-dedupcrop") == 0 || arg.compare("--dedup-crop") == 0) {
+                options.dedupCrop = true;
+            } else if (arg.compare("-stable") == 0 || arg.compare("--stable-layout") == 0) {
+                options.stableMap = FindParam(argc, argv, arg, i, paramStr);
+            } else if (arg.compare("-sfill") == 0 || arg.compare("--stable-fill") == 0) {
+                options.stableFill = atoi(FindParam(argc, argv, arg, i, paramStr));
+            } else if (arg.compare("-pin") == 0 || arg.compare("--pin") == 0) {
+                std::string pinStr = FindParam(argc, argv, arg, i, paramStr);
+                size_t sep = pinStr.find_last_of(':');
+                Options::Pin pin;
+                if (sep == std::string::npos || sep == 0 || sscanf(pinStr.c_str() + sep + 1, "%d,%d", &pin.x, &pin.y) != 2) {
+                    error("Invalid pinned image, expected name:x,y: %s", pinStr.c_str());
+                }
+                pin.name = pinStr.substr(0, sep);
+                options.pins.push_back(pin);
+            } else if (arg.compare("-reserve") == 0 || arg.compare("--reserve") == 0) {
+                const char *regionStr = FindParam(argc, argv, arg, i, paramStr);
+                Options::Region region;
+                if (sscanf(regionStr, "%d,%d,%d,%d", &region.x, &region.y, &region.w, &region.h) != 4 || region.w <= 0 || region.h <= 0) {
+                    error("Invalid reserved area, expected x,y,w,h: %s", regionStr);
+                }
+                options.reserved.push_back(region);
+            } else if (arg.compare("-ba") == 0 || arg.compare("--block-align") == 0) {
+                options.blockAlign = atoi(FindParam(argc, argv, arg, i, paramStr));
+                if (options.blockAlign < 1) {
+                    error("Invalid block alignment: %d", options.blockAlign);
+                }
+            } else if (arg.compare("-cell") == 0 || arg.compare("--mask-cell") == 0) {
+                options.maskCell = atoi(FindParam(argc, argv, arg, i, paramStr));
+                if (options.maskCell < 1) {
+                    error("Invalid mask cell size: %d", options.maskCell);
+                }
+            } else if (arg.compare("-split") == 0 || arg.compare("--split-sparse") == 0) {
+                options.splitSparse = true;
             } else if (arg.compare("-h") == 0 || arg.compare("--help") == 0) {
                 help(stdout);
                 exit(0);
@@ -144,9 +246,16 @@ int main(int argc, char* argv[])
     if (options.infiles.empty()) {
         error("No input files specified");
     }
-    if (options.outfile.empty()) {
+    if (options.outfile.empty() && !options.benchmark) {
         error("No output file specified");
     }
+    if (!heuristic.empty()) {
+        // Resolved after all arguments since the valid names depend on the algorithm
+        options.heuristic = FindHeuristic(options.algorithm, heuristic);
+        if (options.heuristic < 0) {
+            error("Unrecognized heuristic for the algorithm: %s", heuristic.c_str());
+        }
+    }
 
     ImagePack(options);
 	return 0;